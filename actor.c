@@ -0,0 +1,454 @@
+//
+// The MIT License (MIT)
+//
+// Copyright (c)  2022 Vasilis Mylonas
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include "actor.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The mailbox is Dmitry Vyukov's intrusive MPSC queue. Producers swap themselves into head, the
+// single consumer (the worker currently running the actor) walks from tail. The stub node keeps
+// the queue non-empty so that push never has to touch tail.
+
+static void __actor_push(actor_t* self, struct __actor_msg* msg)
+{
+    atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+    struct __actor_msg* prev =
+        atomic_exchange_explicit(&self->_private.head, msg, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, msg, memory_order_release);
+}
+
+static struct __actor_msg* __actor_pop(actor_t* self)
+{
+    struct __actor_msg* stub = &self->_private.stub;
+    struct __actor_msg* tail = self->_private.tail;
+    struct __actor_msg* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+
+        self->_private.tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        self->_private.tail = next;
+        return tail;
+    }
+
+    // A producer has swapped head but not linked its message yet. Its message will be picked up
+    // on a later activation.
+    if (tail != atomic_load_explicit(&self->_private.head, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    __actor_push(self, stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (next != NULL)
+    {
+        self->_private.tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+#define ACTOR_SLAB_MESSAGES 64
+
+// Messages are allocated from slabs that live as long as the pool, and recycled through a free
+// list. Slab k holds ACTOR_SLAB_MESSAGES << k messages, so that a 32-bit index identifies any
+// message. The head of the free list packs the index of the first message plus one with a counter
+// bumped by every change, which makes the lock-free pop safe from the ABA problem.
+
+static struct __actor_msg* __actor_msg_at(actor_pool_t* pool, uint32_t index)
+{
+    const uint64_t group = (uint64_t)index / ACTOR_SLAB_MESSAGES + 1;
+    const size_t slab = 63 - (size_t)__builtin_clzll(group);
+    const uint64_t offset = index - ACTOR_SLAB_MESSAGES * (((uint64_t)1 << slab) - 1);
+    return atomic_load_explicit(&pool->_private.slabs[slab], memory_order_acquire) + offset;
+}
+
+static uint64_t __actor_free_head(uint64_t previous, uint32_t link)
+{
+    return ((previous >> 32) + 1) << 32 | link;
+}
+
+// Pushes the chain of messages from first to last, linked through free_next.
+static void __actor_free_push(actor_pool_t* pool,
+                              struct __actor_msg* first,
+                              struct __actor_msg* last)
+{
+    uint64_t head = atomic_load_explicit(&pool->_private.free, memory_order_relaxed);
+    do
+    {
+        atomic_store_explicit(&last->free_next, (uint32_t)head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->_private.free,
+                                                    &head,
+                                                    __actor_free_head(head, first->index + 1),
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static struct __actor_msg* __actor_free_pop(actor_pool_t* pool)
+{
+    uint64_t head = atomic_load_explicit(&pool->_private.free, memory_order_acquire);
+    while ((uint32_t)head != 0)
+    {
+        // The message may be taken by someone else meanwhile, in which case the counter in head
+        // has changed and the link read here is discarded.
+        struct __actor_msg* msg = __actor_msg_at(pool, (uint32_t)head - 1);
+        const uint32_t link = atomic_load_explicit(&msg->free_next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&pool->_private.free,
+                                                  &head,
+                                                  __actor_free_head(head, link),
+                                                  memory_order_acquire,
+                                                  memory_order_acquire))
+        {
+            return msg;
+        }
+    }
+
+    return NULL;
+}
+
+// Adds a slab, returning its first message and putting the rest on the free list. Returns NULL if
+// another thread added the slab first, in which case its messages are on the way.
+static struct __actor_msg* __actor_grow(actor_pool_t* pool, bool* failed)
+{
+    size_t slab = 0;
+    while (slab < __ACTOR_SLABS_MAX &&
+           atomic_load_explicit(&pool->_private.slabs[slab], memory_order_acquire) != NULL)
+    {
+        slab++;
+    }
+
+    const size_t count = (size_t)ACTOR_SLAB_MESSAGES << slab;
+    struct __actor_msg* messages =
+        slab == __ACTOR_SLABS_MAX ? NULL : malloc(count * sizeof(struct __actor_msg));
+    if (messages == NULL)
+    {
+        *failed = true;
+        return NULL;
+    }
+
+    const uint32_t base = (uint32_t)(ACTOR_SLAB_MESSAGES * ((1u << slab) - 1));
+    for (size_t i = 0; i < count; i++)
+    {
+        messages[i].index = base + (uint32_t)i;
+        atomic_init(&messages[i].free_next, base + (uint32_t)i + 2);
+    }
+
+    struct __actor_msg* expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&pool->_private.slabs[slab],
+                                                 &expected,
+                                                 messages,
+                                                 memory_order_release,
+                                                 memory_order_relaxed))
+    {
+        free(messages);
+        return NULL;
+    }
+
+    __actor_free_push(pool, &messages[1], &messages[count - 1]);
+    return &messages[0];
+}
+
+static struct __actor_msg* __actor_alloc(actor_pool_t* pool)
+{
+    bool failed = false;
+    struct __actor_msg* msg;
+    while ((msg = __actor_free_pop(pool)) == NULL && (msg = __actor_grow(pool, &failed)) == NULL &&
+           !failed)
+    {
+    }
+
+    return msg;
+}
+
+// tail is read by the caller while it still owns the actor, as another worker may already be
+// popping by the time this is called.
+static bool __actor_empty(actor_t* self, struct __actor_msg* tail)
+{
+    struct __actor_msg* stub = &self->_private.stub;
+    return tail == stub && atomic_load(&self->_private.head) == stub;
+}
+
+static void __actor_enqueue(actor_pool_t* pool, actor_t* actor)
+{
+    actor->_private.next = NULL;
+
+    mtx_lock(&pool->_private.lock);
+    if (pool->_private.tail == NULL)
+    {
+        pool->_private.head = actor;
+    }
+    else
+    {
+        pool->_private.tail->_private.next = actor;
+    }
+    pool->_private.tail = actor;
+    mtx_unlock(&pool->_private.lock);
+
+    cnd_signal(&pool->_private.ready);
+}
+
+static actor_t* __actor_dequeue(actor_pool_t* pool)
+{
+    mtx_lock(&pool->_private.lock);
+
+    while (pool->_private.head == NULL && !pool->_private.stopping)
+    {
+        cnd_wait(&pool->_private.ready, &pool->_private.lock);
+    }
+
+    actor_t* actor = pool->_private.head;
+    if (actor != NULL)
+    {
+        pool->_private.head = actor->_private.next;
+        if (pool->_private.head == NULL)
+        {
+            pool->_private.tail = NULL;
+        }
+    }
+
+    mtx_unlock(&pool->_private.lock);
+    return actor;
+}
+
+static void __actor_release(actor_pool_t* pool)
+{
+    if (atomic_fetch_sub(&pool->_private.active, 1) == 1)
+    {
+        mtx_lock(&pool->_private.lock);
+        cnd_broadcast(&pool->_private.idle);
+        mtx_unlock(&pool->_private.lock);
+    }
+}
+
+static void __actor_run(actor_t* self, size_t batch)
+{
+    // Consecutive messages usually have the same selector, so only look up the method when the
+    // selector changes. Selectors are compared by address first, which catches string literals.
+    const char* selector = NULL;
+    void (*impl)(obj_t*, void*, const char*) = NULL;
+
+    // Processed messages are returned to the pool all at once.
+    struct __actor_msg* first = NULL;
+    struct __actor_msg* last = NULL;
+
+    for (size_t i = 0; i < batch; i++)
+    {
+        struct __actor_msg* msg = __actor_pop(self);
+        if (msg == NULL)
+        {
+            break;
+        }
+
+        if (msg->selector != selector && (selector == NULL || strcmp(msg->selector, selector) != 0))
+        {
+            selector = msg->selector;
+            impl = (void (*)(obj_t*, void*, const char*))__obj_get_method(self->_private.object,
+                                                                           selector);
+        }
+
+        impl(self->_private.object, msg->payload, msg->selector);
+
+        atomic_store_explicit(
+            &msg->free_next, first == NULL ? 0 : first->index + 1, memory_order_relaxed);
+        first = msg;
+        last = last == NULL ? msg : last;
+    }
+
+    if (first != NULL)
+    {
+        __actor_free_push(self->_private.pool, first, last);
+    }
+}
+
+static int __actor_worker(void* arg)
+{
+    actor_pool_t* pool = arg;
+
+    actor_t* actor;
+    while ((actor = __actor_dequeue(pool)) != NULL)
+    {
+        __actor_run(actor, pool->_private.batch);
+        struct __actor_msg* tail = actor->_private.tail;
+
+        // Go idle before the final emptiness check, so that a producer that pushes after the check
+        // sees the actor as idle and schedules it itself.
+        atomic_store(&actor->_private.scheduled, false);
+
+        if (!__actor_empty(actor, tail) && !atomic_exchange(&actor->_private.scheduled, true))
+        {
+            // Still has messages (or the batch limit was hit), go to the back of the queue.
+            __actor_enqueue(pool, actor);
+        }
+        else
+        {
+            __actor_release(pool);
+        }
+    }
+
+    return 0;
+}
+
+int actor_pool_create(actor_pool_t* self, size_t threads, size_t batch)
+{
+    if (threads == 0)
+    {
+        return EINVAL;
+    }
+
+    self->_private.thread_count = 0;
+    self->_private.batch = batch == 0 ? ACTOR_BATCH_DEFAULT : batch;
+    self->_private.head = NULL;
+    self->_private.tail = NULL;
+    self->_private.stopping = false;
+    atomic_init(&self->_private.active, 0);
+    atomic_init(&self->_private.free, 0);
+    for (size_t i = 0; i < __ACTOR_SLABS_MAX; i++)
+    {
+        atomic_init(&self->_private.slabs[i], NULL);
+    }
+
+    self->_private.threads = malloc(threads * sizeof(thrd_t));
+    if (self->_private.threads == NULL)
+    {
+        return ENOMEM;
+    }
+
+    mtx_init(&self->_private.lock, mtx_plain);
+    cnd_init(&self->_private.ready);
+    cnd_init(&self->_private.idle);
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        if (thrd_create(&self->_private.threads[i], __actor_worker, self) != thrd_success)
+        {
+            actor_pool_destroy(self);
+            return EAGAIN;
+        }
+
+        self->_private.thread_count++;
+    }
+
+    return 0;
+}
+
+void actor_pool_wait(actor_pool_t* self)
+{
+    mtx_lock(&self->_private.lock);
+    while (atomic_load(&self->_private.active) != 0)
+    {
+        cnd_wait(&self->_private.idle, &self->_private.lock);
+    }
+    mtx_unlock(&self->_private.lock);
+}
+
+void actor_pool_destroy(actor_pool_t* self)
+{
+    actor_pool_wait(self);
+
+    mtx_lock(&self->_private.lock);
+    self->_private.stopping = true;
+    mtx_unlock(&self->_private.lock);
+    cnd_broadcast(&self->_private.ready);
+
+    for (size_t i = 0; i < self->_private.thread_count; i++)
+    {
+        thrd_join(self->_private.threads[i], NULL);
+    }
+
+    cnd_destroy(&self->_private.idle);
+    cnd_destroy(&self->_private.ready);
+    mtx_destroy(&self->_private.lock);
+    free(self->_private.threads);
+
+    for (size_t i = 0; i < __ACTOR_SLABS_MAX; i++)
+    {
+        free(atomic_load_explicit(&self->_private.slabs[i], memory_order_relaxed));
+    }
+}
+
+void actor_create(actor_t* self, actor_pool_t* pool, obj_t* object)
+{
+    self->_private.object = object;
+    self->_private.pool = pool;
+    self->_private.next = NULL;
+    self->_private.tail = &self->_private.stub;
+    atomic_init(&self->_private.stub.next, NULL);
+    atomic_init(&self->_private.head, &self->_private.stub);
+    atomic_init(&self->_private.scheduled, false);
+}
+
+void actor_destroy(actor_t* self)
+{
+    struct __actor_msg* msg;
+    while ((msg = __actor_pop(self)) != NULL)
+    {
+        __actor_free_push(self->_private.pool, msg, msg);
+    }
+}
+
+int actor_send(actor_t* self, const char* selector, const void* payload, size_t size)
+{
+    if (size > ACTOR_PAYLOAD_MAX)
+    {
+        return EMSGSIZE;
+    }
+
+    struct __actor_msg* msg = __actor_alloc(self->_private.pool);
+    if (msg == NULL)
+    {
+        return ENOMEM;
+    }
+
+    msg->selector = selector;
+    msg->size = size;
+    if (size != 0)
+    {
+        memcpy(msg->payload, payload, size);
+    }
+
+    __actor_push(self, msg);
+
+    if (!atomic_exchange(&self->_private.scheduled, true))
+    {
+        atomic_fetch_add(&self->_private.pool->_private.active, 1);
+        __actor_enqueue(self->_private.pool, self);
+    }
+
+    return 0;
+}
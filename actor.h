@@ -0,0 +1,223 @@
+//
+// The MIT License (MIT)
+//
+// Copyright (c)  2022 Vasilis Mylonas
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef ACTOR_H
+#define ACTOR_H
+
+/**
+ * @file actor.h
+ * @author Vasilis Mylonas <vasilismylonas@protonmail.com>
+ * @brief Actors for libobj objects.
+ * @version 0.1
+ * @date 2022-04-24
+ * @copyright Copyright (c) 2022 Vasilis Mylonas
+ *
+ * libactor lets libobj objects process messages concurrently without any locking on their part. An
+ * actor wraps an object and owns a lock-free mailbox that any thread may send messages to. A
+ * message names a method of the object (its selector) and carries a small payload that is copied
+ * into the message. A pool of worker threads runs actors that have pending messages, processing up
+ * to a fixed number of messages per activation. The messages of one actor are processed one at a
+ * time and in the order they were sent by each sender, so an object's methods never run
+ * concurrently with each other.
+ *
+ * Message handlers are regular libobj methods:
+ *
+ * @code
+ *
+ * void counter_add_impl(obj_t* self, void* payload, const char* name)
+ * {
+ *     ((counter_t*)self)->value += *(int*)payload;
+ * }
+ *
+ * ...
+ *
+ * actor_pool_t pool;
+ * actor_pool_create(&pool, 4, 0);
+ *
+ * actor_t actor;
+ * actor_create(&actor, &pool, OBJ(&counter));
+ *
+ * int amount = 5;
+ * ACTOR_SEND(&actor, counter_add, &amount);
+ *
+ * actor_pool_wait(&pool);
+ * actor_destroy(&actor);
+ * actor_pool_destroy(&pool);
+ *
+ * @endcode
+ */
+
+#include "obj.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+/**
+ * The maximum size of a message payload.
+ */
+#define ACTOR_PAYLOAD_MAX 48
+
+/**
+ * The default number of messages an actor processes per activation.
+ */
+#define ACTOR_BATCH_DEFAULT 64
+
+/**
+ * Sends a message to an actor.
+ *
+ * @param self The actor.
+ * @param method The method to call.
+ * @param payload A pointer to the payload, which is copied.
+ * @return 0 on success, EMSGSIZE if the payload is too large, ENOMEM on allocation failure.
+ */
+#define ACTOR_SEND(self, method, payload) actor_send(self, #method, payload, sizeof(*(payload)))
+
+#ifndef DOXYGEN
+#define __ACTOR_SLABS_MAX 26
+
+struct __actor_msg
+{
+    _Atomic(struct __actor_msg*) next;
+    uint32_t index;
+    _Atomic(uint32_t) free_next;
+    const char* selector;
+    size_t size;
+    max_align_t payload[(ACTOR_PAYLOAD_MAX + sizeof(max_align_t) - 1) / sizeof(max_align_t)];
+};
+#endif // DOXYGEN
+
+/**
+ * A pool of worker threads that runs actors.
+ *
+ * actor_pool_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        thrd_t* threads;
+        size_t thread_count;
+        size_t batch;
+        mtx_t lock;
+        cnd_t ready;
+        cnd_t idle;
+        struct actor* head;
+        struct actor* tail;
+        atomic_size_t active;
+        bool stopping;
+        _Atomic(uint64_t) free;
+        _Atomic(struct __actor_msg*) slabs[__ACTOR_SLABS_MAX];
+    } _private;
+} actor_pool_t;
+
+/**
+ * An object together with its mailbox.
+ *
+ * actor_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct actor
+{
+    struct
+    {
+        obj_t* object;
+        actor_pool_t* pool;
+        _Atomic(struct __actor_msg*) head;
+        struct __actor_msg* tail;
+        struct __actor_msg stub;
+        atomic_bool scheduled;
+        struct actor* next;
+    } _private;
+} actor_t;
+
+/**
+ * Initializes a pool and starts its worker threads.
+ *
+ * @param self The pool.
+ * @param threads The number of worker threads.
+ * @param batch The maximum number of messages an actor processes before other actors get a turn.
+ *              A value of 0 is the same as ACTOR_BATCH_DEFAULT.
+ * @return 0 on success, EINVAL if threads is 0, ENOMEM on allocation failure, EAGAIN if threads
+ *         could not be created.
+ */
+int actor_pool_create(actor_pool_t* self, size_t threads, size_t batch);
+
+/**
+ * Waits for all pending messages to be processed, then stops the worker threads.
+ *
+ * Messages are allocated from memory owned by the pool, so its actors must be destroyed first.
+ *
+ * @param self The pool.
+ */
+void actor_pool_destroy(actor_pool_t* self);
+
+/**
+ * Waits until no actor in a pool has pending messages.
+ *
+ * Messages sent concurrently with this call may or may not be waited for.
+ *
+ * @param self The pool.
+ */
+void actor_pool_wait(actor_pool_t* self);
+
+/**
+ * Initializes an actor.
+ *
+ * @param self The actor.
+ * @param pool The pool that runs the actor.
+ * @param object The object that receives the messages. It must outlive the actor.
+ */
+void actor_create(actor_t* self, actor_pool_t* pool, obj_t* object);
+
+/**
+ * Destroys an actor, discarding any pending messages.
+ *
+ * The actor must not be running, for example because actor_pool_wait() has returned and no more
+ * messages have been sent since.
+ *
+ * @param self The actor.
+ */
+void actor_destroy(actor_t* self);
+
+/**
+ * Sends a message to an actor.
+ *
+ * This never blocks. The method is called on a worker thread with the object, a pointer to a copy
+ * of the payload and the method name as arguments. A missing method is handled like a missing
+ * method in OBJ_CALL.
+ *
+ * @param self The actor.
+ * @param selector The name of the method to call.
+ * @param payload The payload, which is copied. This may be NULL if size is 0.
+ * @param size The size of the payload.
+ * @return 0 on success, EMSGSIZE if the payload is larger than ACTOR_PAYLOAD_MAX, ENOMEM on
+ *         allocation failure.
+ *
+ * @see ACTOR_SEND
+ */
+int actor_send(actor_t* self, const char* selector, const void* payload, size_t size);
+
+#endif // ACTOR_H
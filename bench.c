@@ -0,0 +1,462 @@
+//
+// The MIT License (MIT)
+//
+// Copyright (c)  2022 Vasilis Mylonas
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include "except.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures the costs of libexcept and prints them as CSV, one line per benchmark, mode and
+// parameter. The time of each is the minimum and median of BENCH_REPEATS runs, in nanoseconds per
+// iteration. An optional argument only runs the benchmarks whose name contains it.
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 100000
+#endif
+
+#ifndef BENCH_REPEATS
+#define BENCH_REPEATS 7
+#endif
+
+EXCEPT_RESULT_DECLARE(int);
+
+// Calls go through a volatile pointer so that they are neither inlined nor turned into loops.
+static int descend_impl(int depth);
+static int (*volatile descend)(int) = descend_impl;
+
+// Throws after depth - 1 more calls.
+static int descend_impl(int depth)
+{
+    if (depth <= 1)
+    {
+        throw(int, depth);
+    }
+
+    return descend(depth - 1) + 1;
+}
+
+static void try_entry(size_t iterations, int parameter)
+{
+    (void)parameter;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+static void try_fast_entry(size_t iterations, int parameter)
+{
+    (void)parameter;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_fast
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+static void try_with_deadline_entry(size_t iterations, int parameter)
+{
+    (void)parameter;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_with_deadline (1000)
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+static int succeed()
+{
+    return 0;
+}
+
+static int (*volatile succeed_indirect)() = succeed;
+
+static void try_result_entry(size_t iterations, int parameter)
+{
+    (void)parameter;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        EXCEPT_RESULT(int) result = try_result(int, succeed_indirect());
+        except_discard(&result.error);
+    }
+}
+
+static void try_finally(size_t iterations, int parameter)
+{
+    (void)parameter;
+    volatile int finished = 0;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+        }
+        finally
+        {
+            finished++;
+        }
+    }
+}
+
+static void try_fast_finally(size_t iterations, int parameter)
+{
+    (void)parameter;
+    volatile int finished = 0;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_fast
+        {
+        }
+        finally
+        {
+            finished++;
+        }
+    }
+}
+
+static void try_throw_depth(size_t iterations, int depth)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            descend(depth);
+        }
+        catch (int, e)
+        {
+            (void)e;
+        }
+    }
+}
+
+static void try_fast_throw_depth(size_t iterations, int depth)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_fast
+        {
+            descend(depth);
+        }
+        catch (int, e)
+        {
+            (void)e;
+        }
+    }
+}
+
+static void try_result_throw_depth(size_t iterations, int depth)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        EXCEPT_RESULT(int) result = try_result(int, descend(depth));
+        except_discard(&result.error);
+    }
+}
+
+// Each link of the chain catches and rethrows what the links below it throw.
+#define DEFINE_RETHROW_CHAIN(mode)                                                                 \
+    static void mode##_rethrow_link(int length)                                                    \
+    {                                                                                              \
+        if (length == 0)                                                                           \
+        {                                                                                          \
+            throw(int, 0);                                                                         \
+        }                                                                                          \
+                                                                                                   \
+        mode                                                                                       \
+        {                                                                                          \
+            mode##_rethrow_link(length - 1);                                                       \
+        }                                                                                          \
+        catch (int, e)                                                                             \
+        {                                                                                          \
+            (void)e;                                                                               \
+            rethrow();                                                                             \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static void mode##_rethrow_chain(size_t iterations, int length)                                \
+    {                                                                                              \
+        for (size_t i = 0; i < iterations; i++)                                                    \
+        {                                                                                          \
+            mode                                                                                   \
+            {                                                                                      \
+                mode##_rethrow_link(length);                                                       \
+            }                                                                                      \
+            catch (int, e)                                                                         \
+            {                                                                                      \
+                (void)e;                                                                           \
+            }                                                                                      \
+        }                                                                                          \
+    }
+
+DEFINE_RETHROW_CHAIN(try)
+DEFINE_RETHROW_CHAIN(try_fast)
+
+static void try_signal_raise(size_t iterations, int parameter)
+{
+    (void)parameter;
+    except_enable_sigcatch();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            raise(SIGFPE);
+        }
+        catch (arithmetic_error_t, e)
+        {
+            (void)e;
+        }
+    }
+    except_disable_sigcatch();
+}
+
+static void try_fast_signal_raise(size_t iterations, int parameter)
+{
+    (void)parameter;
+    except_enable_sigcatch();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_fast
+        {
+            raise(SIGFPE);
+        }
+        catch (arithmetic_error_t, e)
+        {
+            (void)e;
+        }
+    }
+    except_disable_sigcatch();
+}
+
+static void try_signal_fault(size_t iterations, int parameter)
+{
+    (void)parameter;
+    except_enable_sigcatch();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            *(volatile int*)NULL;
+        }
+        catch (access_violation_t, e)
+        {
+            (void)e;
+        }
+    }
+    except_disable_sigcatch();
+}
+
+static void try_fast_signal_fault(size_t iterations, int parameter)
+{
+    (void)parameter;
+    except_enable_sigcatch();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_fast
+        {
+            *(volatile int*)NULL;
+        }
+        catch (access_violation_t, e)
+        {
+            (void)e;
+        }
+    }
+    except_disable_sigcatch();
+}
+
+// Clauses that never match an int, ahead of the one that does.
+#define MISS    catch (arithmetic_error_t, e) { (void)e; }
+#define MISS_2  MISS MISS
+#define MISS_4  MISS_2 MISS_2
+#define MISS_8  MISS_4 MISS_4
+#define MISS_16 MISS_8 MISS_8
+
+#define DEFINE_CATCH_CLAUSES(mode, n, misses)                                                      \
+    static void mode##_catch_clauses_##n(size_t iterations, int parameter)                         \
+    {                                                                                              \
+        (void)parameter;                                                                           \
+        for (size_t i = 0; i < iterations; i++)                                                    \
+        {                                                                                          \
+            mode                                                                                   \
+            {                                                                                      \
+                descend(1);                                                                        \
+            }                                                                                      \
+            misses catch (int, e)                                                                  \
+            {                                                                                      \
+                (void)e;                                                                           \
+            }                                                                                      \
+        }                                                                                          \
+    }
+
+DEFINE_CATCH_CLAUSES(try, 0, )
+DEFINE_CATCH_CLAUSES(try, 1, MISS)
+DEFINE_CATCH_CLAUSES(try, 2, MISS_2)
+DEFINE_CATCH_CLAUSES(try, 4, MISS_4)
+DEFINE_CATCH_CLAUSES(try, 8, MISS_8)
+DEFINE_CATCH_CLAUSES(try, 16, MISS_16)
+DEFINE_CATCH_CLAUSES(try_fast, 0, )
+DEFINE_CATCH_CLAUSES(try_fast, 1, MISS)
+DEFINE_CATCH_CLAUSES(try_fast, 2, MISS_2)
+DEFINE_CATCH_CLAUSES(try_fast, 4, MISS_4)
+DEFINE_CATCH_CLAUSES(try_fast, 8, MISS_8)
+DEFINE_CATCH_CLAUSES(try_fast, 16, MISS_16)
+
+#define DEFINE_CATCH_ONE_OF(mode)                                                                  \
+    static void mode##_catch_one_of(size_t iterations, int parameter)                              \
+    {                                                                                              \
+        (void)parameter;                                                                           \
+        for (size_t i = 0; i < iterations; i++)                                                    \
+        {                                                                                          \
+            mode                                                                                   \
+            {                                                                                      \
+                descend(1);                                                                        \
+            }                                                                                      \
+            catch_one_of (e,                                                                       \
+                          arithmetic_error_t,                                                      \
+                          illegal_instruction_error_t,                                             \
+                          stack_corruption_error_t,                                                \
+                          access_violation_t,                                                      \
+                          misaligned_access_error_t,                                               \
+                          timeout_error_t,                                                         \
+                          out_of_memory_error_t,                                                   \
+                          int)                                                                     \
+            {                                                                                      \
+                (void)e;                                                                           \
+            }                                                                                      \
+        }                                                                                          \
+    }
+
+DEFINE_CATCH_ONE_OF(try)
+DEFINE_CATCH_ONE_OF(try_fast)
+
+typedef struct
+{
+    const char* name;
+    const char* mode;
+    int parameter;
+    void (*run)(size_t iterations, int parameter);
+} bench_t;
+
+#define BENCH_DEPTHS(name, mode, run)                                                              \
+    {name, mode, 1, run}, {name, mode, 2, run}, {name, mode, 4, run}, {name, mode, 8, run},        \
+        {name, mode, 16, run}, {name, mode, 32, run}, {name, mode, 64, run}
+
+#define BENCH_LENGTHS(name, mode, run)                                                             \
+    {name, mode, 1, run}, {name, mode, 2, run}, {name, mode, 4, run}, {name, mode, 8, run},        \
+        {name, mode, 16, run}
+
+#define BENCH_CATCH_CLAUSES(mode, prefix)                                                          \
+    {"catch_clauses", mode, 0, prefix##_catch_clauses_0},                                          \
+        {"catch_clauses", mode, 1, prefix##_catch_clauses_1},                                      \
+        {"catch_clauses", mode, 2, prefix##_catch_clauses_2},                                      \
+        {"catch_clauses", mode, 4, prefix##_catch_clauses_4},                                      \
+        {"catch_clauses", mode, 8, prefix##_catch_clauses_8},                                      \
+        {"catch_clauses", mode, 16, prefix##_catch_clauses_16}
+
+static const bench_t benches[] = {
+    {"entry", "try", 0, try_entry},
+    {"entry", "try_fast", 0, try_fast_entry},
+    {"entry", "try_result", 0, try_result_entry},
+    {"entry", "try_with_deadline", 0, try_with_deadline_entry},
+    {"finally", "try", 0, try_finally},
+    {"finally", "try_fast", 0, try_fast_finally},
+    BENCH_DEPTHS("throw_depth", "try", try_throw_depth),
+    BENCH_DEPTHS("throw_depth", "try_fast", try_fast_throw_depth),
+    BENCH_DEPTHS("throw_depth", "try_result", try_result_throw_depth),
+    BENCH_LENGTHS("rethrow_chain", "try", try_rethrow_chain),
+    BENCH_LENGTHS("rethrow_chain", "try_fast", try_fast_rethrow_chain),
+    {"signal_raise", "try", 0, try_signal_raise},
+    {"signal_raise", "try_fast", 0, try_fast_signal_raise},
+    {"signal_fault", "try", 0, try_signal_fault},
+    {"signal_fault", "try_fast", 0, try_fast_signal_fault},
+    BENCH_CATCH_CLAUSES("try", try),
+    BENCH_CATCH_CLAUSES("try_fast", try_fast),
+    {"catch_one_of", "try", 8, try_catch_one_of},
+    {"catch_one_of", "try_fast", 8, try_fast_catch_one_of},
+};
+
+static double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* filter = argc > 1 ? argv[1] : "";
+
+    printf("benchmark,mode,parameter,iterations,min_ns,median_ns\n");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        const bench_t* bench = &benches[i];
+        if (strstr(bench->name, filter) == NULL)
+        {
+            continue;
+        }
+
+        // Warm up the caches and the exception arena.
+        bench->run(BENCH_ITERATIONS / 10, bench->parameter);
+
+        double times[BENCH_REPEATS];
+        for (size_t j = 0; j < BENCH_REPEATS; j++)
+        {
+            const double start = bench_now();
+            bench->run(BENCH_ITERATIONS, bench->parameter);
+            times[j] = (bench_now() - start) / BENCH_ITERATIONS;
+        }
+
+        qsort(times, BENCH_REPEATS, sizeof(double), bench_compare);
+        printf("%s,%s,%i,%u,%.1f,%.1f\n",
+               bench->name,
+               bench->mode,
+               bench->parameter,
+               BENCH_ITERATIONS,
+               times[0],
+               times[BENCH_REPEATS / 2]);
+        fflush(stdout);
+    }
+}
@@ -195,6 +195,22 @@ jmp_buf* __defer_frame_context()
     return &__defer_frame_current->context;
 }
 
+void* __defer_frame()
+{
+    return __defer_frame_current;
+}
+
+void __defer_unwind_to(void* frame)
+{
+    // The functions of these frames are left by a longjmp, so they never deregister them.
+    while (__defer_frame_current != NULL && __defer_frame_current != frame)
+    {
+        defer_frame_t* self = __defer_frame_current;
+        __defer_frame_deregister(self);
+        free(self);
+    }
+}
+
 void __defer_frame_register(defer_frame_t* self)
 {
     assert(self != NULL);
@@ -59,4 +59,8 @@ extern void defer_thrd_init();
 // Implementation detail.
 extern jmp_buf* __defer_frame_context();
 
+// Used by libexcept to run the handlers of the frames a throw skips.
+extern void* __defer_frame();
+extern void __defer_unwind_to(void* frame);
+
 #endif // DEFER_H
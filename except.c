@@ -22,21 +22,590 @@
 //  DEALINGS IN THE SOFTWARE.
 //
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "except.h"
 
+#ifdef EXCEPT_HAVE_EXECINFO
+#include <execinfo.h>
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct __except_chunk
+{
+    struct __except_chunk* previous;
+    size_t size;
+    size_t used;
+    bool emergency;
+    max_align_t data[];
+};
+
+struct __except_record
+{
+    except_type_t* type;
+    struct __except_record* cause;
+    void** frames;
+    size_t frame_count;
+    size_t unwound;
+    bool caught;
+    bool captured;
+    size_t size;
+    max_align_t data[];
+};
+
+enum
+{
+    __EXCEPT_STAT_THROWS,
+    __EXCEPT_STAT_CATCHES,
+    __EXCEPT_STAT_RETHROWS,
+    __EXCEPT_STAT_UNHANDLED,
+    __EXCEPT_STAT_COUNT,
+};
+
+// Only the owning thread writes its counters, so they are bumped with plain relaxed loads and
+// stores. Readers sum them up under the lock, which also protects the list of live threads.
+struct __except_stats
+{
+    struct __except_stats* previous;
+    struct __except_stats* next;
+    atomic_uint_fast64_t counts[EXCEPT_STATS_TYPES_MAX][__EXCEPT_STAT_COUNT];
+    atomic_uint_fast64_t depths[EXCEPT_STATS_DEPTH_MAX];
+};
+
+static thread_local struct __except_stats* stats;
+
+// The owner of a log is its only writer and the lock holder its only reader. A log outlives its
+// thread until the reader has drained it.
+struct __except_log
+{
+    struct __except_log* next;
+    atomic_bool exited;
+    atomic_size_t head;
+    atomic_size_t tail;
+    except_log_entry_t entries[EXCEPT_LOG_SIZE];
+};
+
+static_assert((EXCEPT_LOG_SIZE & (EXCEPT_LOG_SIZE - 1)) == 0,
+              "EXCEPT_LOG_SIZE must be a power of 2");
+
+static atomic_bool __except_logging;
+static thread_local struct __except_log* throw_log;
+static thread_local size_t log_dropped;
+
+// Set by the signal and deadline handlers for the throw they are about to make, which must not
+// allocate or take a lock.
+static thread_local bool throw_from_handler;
+
+#ifdef EXCEPT_HAVE_EXECINFO
+static atomic_size_t __except_backtrace_depth;
+#endif
+
+// The arena is a stack of chunks. A spare chunk is kept so that throwing in a loop does not
+// allocate every time.
+static thread_local struct __except_chunk* arena;
+static thread_local struct __except_chunk* spare;
+
+// Chunks set aside for when malloc fails. A set bit marks a chunk as taken.
+static struct
+{
+    struct __except_chunk header;
+    max_align_t data[EXCEPT_ARENA_CHUNK_SIZE / sizeof(max_align_t)];
+} __except_emergency[EXCEPT_EMERGENCY_CHUNKS];
+static atomic_uint_fast64_t __except_emergency_taken;
+
+static_assert(EXCEPT_EMERGENCY_CHUNKS <= 64, "EXCEPT_EMERGENCY_CHUNKS must be at most 64");
+static thread_local struct __except_record* current;
+thread_local except_type_t* __except_thrown;
+
+// The buffer of the innermost try_result, if any.
+static thread_local __EXCEPT_JMP_BUF* result_context;
+
+#define __EXCEPT_DEFINE_SCALAR(T, id)                                                              \
+    except_type_t __except_type_##id = {.name = #T, .size = sizeof(T)}
+
+__EXCEPT_DEFINE_SCALAR(_Bool, bool);
+__EXCEPT_DEFINE_SCALAR(signed char, schar);
+__EXCEPT_DEFINE_SCALAR(unsigned char, uchar);
+__EXCEPT_DEFINE_SCALAR(char, char);
+__EXCEPT_DEFINE_SCALAR(short, short);
+__EXCEPT_DEFINE_SCALAR(unsigned short, ushort);
+__EXCEPT_DEFINE_SCALAR(int, int);
+__EXCEPT_DEFINE_SCALAR(unsigned int, uint);
+__EXCEPT_DEFINE_SCALAR(long, long);
+__EXCEPT_DEFINE_SCALAR(unsigned long, ulong);
+__EXCEPT_DEFINE_SCALAR(long long, longlong);
+__EXCEPT_DEFINE_SCALAR(unsigned long long, ulonglong);
+__EXCEPT_DEFINE_SCALAR(float, float);
+__EXCEPT_DEFINE_SCALAR(double, double);
+__EXCEPT_DEFINE_SCALAR(long double, ldbl);
+
+EXCEPT_DEFINE(arithmetic_error_t);
+EXCEPT_DEFINE(illegal_instruction_error_t);
+EXCEPT_DEFINE(stack_corruption_error_t);
+EXCEPT_DEFINE(memory_error_t);
+EXCEPT_DEFINE_DERIVED(access_violation_t, memory_error_t);
+EXCEPT_DEFINE_DERIVED(misaligned_access_error_t, memory_error_t);
+EXCEPT_DEFINE(timeout_error_t);
+EXCEPT_DEFINE(out_of_memory_error_t);
+
+static once_flag __except_once_flag = ONCE_FLAG_INIT;
+static mtx_t __except_lock;
+
+static tss_t __except_arena_key;
+
+static struct __except_chunk* __except_emergency_take()
+{
+    uint_fast64_t taken = atomic_load_explicit(&__except_emergency_taken, memory_order_relaxed);
+    for (size_t i = 0; i < EXCEPT_EMERGENCY_CHUNKS; i++)
+    {
+        const uint_fast64_t bit = (uint_fast64_t)1 << i;
+        if ((taken & bit) == 0 &&
+            (atomic_fetch_or_explicit(&__except_emergency_taken, bit, memory_order_acquire) &
+             bit) == 0)
+        {
+            struct __except_chunk* chunk = &__except_emergency[i].header;
+            chunk->size = EXCEPT_ARENA_CHUNK_SIZE;
+            chunk->emergency = true;
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+static void __except_chunk_free(struct __except_chunk* chunk)
+{
+    if (chunk != NULL && chunk->emergency)
+    {
+        const size_t i = (size_t)((char*)chunk - (char*)__except_emergency) /
+                         sizeof(__except_emergency[0]);
+        atomic_fetch_and_explicit(
+            &__except_emergency_taken, ~((uint_fast64_t)1 << i), memory_order_release);
+    }
+    else
+    {
+        free(chunk);
+    }
+}
+
+static void __except_arena_free(void* unused)
+{
+    (void)unused;
+
+    while (arena != NULL)
+    {
+        struct __except_chunk* previous = arena->previous;
+        __except_chunk_free(arena);
+        arena = previous;
+    }
+
+    __except_chunk_free(spare);
+    spare = NULL;
+}
+
+// Signals are handled on a stack of their own, preceded by an inaccessible page so that
+// overflowing it crashes rather than corrupting other memory. The bounds of the thread stack are
+// kept to recognize overflows of it.
+static atomic_bool __except_sigcatch;
+static tss_t __except_signal_stack_key;
+static thread_local bool signal_stack_installed;
+static thread_local char* stack_low;
+static thread_local size_t stack_guard;
+
+static size_t __except_signal_stack_size()
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (EXCEPT_SIGNAL_STACK_SIZE + page - 1) / page * page + page;
+}
+
+static void __except_signal_stack_free(void* data)
+{
+    stack_t stack = {.ss_flags = SS_DISABLE};
+    sigaltstack(&stack, NULL);
+    munmap(data, __except_signal_stack_size());
+}
+
+static tss_t __except_log_key;
+static struct __except_log* __except_logs;
+
+static void __except_log_free(void* data)
+{
+    struct __except_log* self = data;
+    atomic_store_explicit(&self->exited, true, memory_order_release);
+    throw_log = NULL;
+}
+
+static tss_t __except_stats_key;
+static struct __except_stats* __except_stats_live;
+static struct __except_stats __except_stats_retired;
+static except_type_t* __except_types[EXCEPT_STATS_TYPES_MAX];
+static size_t __except_type_count;
+
+static void __except_stats_add(struct __except_stats* self, struct __except_stats* other)
+{
+    for (size_t i = 0; i < EXCEPT_STATS_TYPES_MAX; i++)
+    {
+        for (size_t j = 0; j < __EXCEPT_STAT_COUNT; j++)
+        {
+            const uint_fast64_t count =
+                atomic_load_explicit(&other->counts[i][j], memory_order_relaxed);
+            atomic_fetch_add_explicit(&self->counts[i][j], count, memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < EXCEPT_STATS_DEPTH_MAX; i++)
+    {
+        const uint_fast64_t count = atomic_load_explicit(&other->depths[i], memory_order_relaxed);
+        atomic_fetch_add_explicit(&self->depths[i], count, memory_order_relaxed);
+    }
+}
+
+// Folds the counters of an exiting thread into the retired ones.
+static void __except_stats_free(void* data)
+{
+    struct __except_stats* self = data;
+
+    mtx_lock(&__except_lock);
+
+    __except_stats_add(&__except_stats_retired, self);
+
+    if (self->previous != NULL)
+    {
+        self->previous->next = self->next;
+    }
+    else
+    {
+        __except_stats_live = self->next;
+    }
+
+    if (self->next != NULL)
+    {
+        self->next->previous = self->previous;
+    }
+
+    mtx_unlock(&__except_lock);
+
+    free(self);
+    stats = NULL;
+}
+
+static void __except_one_time_init()
+{
+    if (mtx_init(&__except_lock, mtx_plain) != thrd_success ||
+        tss_create(&__except_arena_key, __except_arena_free) != thrd_success ||
+        tss_create(&__except_stats_key, __except_stats_free) != thrd_success ||
+        tss_create(&__except_signal_stack_key, __except_signal_stack_free) != thrd_success ||
+        tss_create(&__except_log_key, __except_log_free) != thrd_success)
+    {
+        fputs("Could not initialize libexcept lock\n", stderr);
+        abort();
+    }
+}
+
+static bool __except_stats_create()
+{
+    struct __except_stats* self = calloc(1, sizeof(struct __except_stats));
+    if (self == NULL)
+    {
+        return false;
+    }
+
+    call_once(&__except_once_flag, __except_one_time_init);
+    mtx_lock(&__except_lock);
+
+    self->next = __except_stats_live;
+    if (__except_stats_live != NULL)
+    {
+        __except_stats_live->previous = self;
+    }
+    __except_stats_live = self;
+
+    mtx_unlock(&__except_lock);
+
+    tss_set(__except_stats_key, self);
+    stats = self;
+    return true;
+}
+
+static void __except_count(const except_type_t* type, int stat)
+{
+    if (stats == NULL && !__except_stats_create())
+    {
+        return;
+    }
+
+    atomic_uint_fast64_t* counter = &stats->counts[type->_private.id][stat];
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static bool __except_log_create()
+{
+    struct __except_log* self = calloc(1, sizeof(struct __except_log));
+    if (self == NULL)
+    {
+        return false;
+    }
+
+    call_once(&__except_once_flag, __except_one_time_init);
+    mtx_lock(&__except_lock);
+    self->next = __except_logs;
+    __except_logs = self;
+    mtx_unlock(&__except_lock);
+
+    tss_set(__except_log_key, self);
+    throw_log = self;
+    return true;
+}
+
+static void __except_log(const except_type_t* type, void* site, bool from_handler)
+{
+    // A handler cannot set up the log, for example if logging was enabled after
+    // __except_prepare_async ran, so its throw is only counted as dropped.
+    if (throw_log == NULL && (from_handler || !__except_log_create()))
+    {
+        log_dropped++;
+        return;
+    }
+
+    const size_t head = atomic_load_explicit(&throw_log->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&throw_log->tail, memory_order_acquire) == EXCEPT_LOG_SIZE)
+    {
+        log_dropped++;
+        return;
+    }
+
+    except_log_entry_t* entry = &throw_log->entries[head & (EXCEPT_LOG_SIZE - 1)];
+    timespec_get(&entry->time, TIME_UTC);
+    entry->type = type;
+    entry->site = site;
+    entry->dropped = log_dropped;
+    log_dropped = 0;
+
+    atomic_store_explicit(&throw_log->head, head + 1, memory_order_release);
+}
+
+// Sets up what a throw of this thread would otherwise allocate or take a lock for, so that throws
+// from signal and deadline handlers do neither: the statistics, the log if logging is enabled and
+// a spare arena chunk. Should the chunk be missing anyway, the throw takes an emergency chunk.
+static void __except_prepare_async()
+{
+
+    if (stats == NULL)
+    {
+        __except_stats_create();
+    }
+
+    if (throw_log == NULL && atomic_load_explicit(&__except_logging, memory_order_relaxed))
+    {
+        __except_log_create();
+    }
+
+    if (spare == NULL)
+    {
+        spare = malloc(sizeof(struct __except_chunk) + EXCEPT_ARENA_CHUNK_SIZE);
+        if (spare != NULL)
+        {
+            spare->size = EXCEPT_ARENA_CHUNK_SIZE;
+            spare->emergency = false;
+
+            call_once(&__except_once_flag, __except_one_time_init);
+            tss_set(__except_arena_key, spare);
+        }
+    }
+}
+
+void except_enable_log(bool enable)
+{
+    atomic_store_explicit(&__except_logging, enable, memory_order_relaxed);
+}
+
+size_t except_log_drain(except_log_entry_t* entries, size_t count)
+{
+    call_once(&__except_once_flag, __except_one_time_init);
+    mtx_lock(&__except_lock);
+
+    size_t taken = 0;
+    for (struct __except_log** link = &__except_logs; *link != NULL && taken < count;)
+    {
+        struct __except_log* self = *link;
+
+        // Read exited first, so that nothing written before the thread exited is missed.
+        const bool exited = atomic_load_explicit(&self->exited, memory_order_acquire);
+        const size_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+        for (; tail != head && taken < count; tail++)
+        {
+            entries[taken++] = self->entries[tail & (EXCEPT_LOG_SIZE - 1)];
+        }
+
+        atomic_store_explicit(&self->tail, tail, memory_order_release);
+
+        if (exited && tail == head)
+        {
+            *link = self->next;
+            free(self);
+        }
+        else
+        {
+            link = &self->next;
+        }
+    }
+
+    mtx_unlock(&__except_lock);
+    return taken;
+}
+
+static void __except_count_depth(size_t depth)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    atomic_uint_fast64_t* counter =
+        &stats->depths[depth < EXCEPT_STATS_DEPTH_MAX ? depth : EXCEPT_STATS_DEPTH_MAX - 1];
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Fills in the depth, ancestors and effective destructor of a type. Runs once per type, the first
+// time it is thrown or caught.
+static void __except_resolve(except_type_t* type)
+{
+    if (atomic_load_explicit(&type->_private.resolved, memory_order_acquire))
+    {
+        return;
+    }
+
+    call_once(&__except_once_flag, __except_one_time_init);
+    mtx_lock(&__except_lock);
+
+    if (!atomic_load_explicit(&type->_private.resolved, memory_order_relaxed))
+    {
+        size_t depth = 0;
+        for (except_type_t* parent = type->parent; parent != NULL; parent = parent->parent)
+        {
+            depth++;
+        }
+
+        if (depth >= EXCEPT_DEPTH_MAX)
+        {
+            fprintf(stderr, "Exception hierarchy of %s exceeds EXCEPT_DEPTH_MAX\n", type->name);
+            abort();
+        }
+
+        // Types beyond the limit share the last slot.
+        type->_private.id = __except_type_count;
+        if (__except_type_count < EXCEPT_STATS_TYPES_MAX - 1)
+        {
+            __except_types[__except_type_count++] = type;
+        }
+
+        type->_private.depth = depth;
+        type->_private.destroy = NULL;
+        for (except_type_t* ancestor = type; ancestor != NULL; ancestor = ancestor->parent)
+        {
+            type->_private.ancestors[depth--] = ancestor;
+            if (type->_private.destroy == NULL)
+            {
+                type->_private.destroy = ancestor->destroy;
+            }
+        }
+
+        atomic_store_explicit(&type->_private.resolved, true, memory_order_release);
+    }
+
+    mtx_unlock(&__except_lock);
+}
+
+static void __except_install_signal_stack()
+{
+    signal_stack_installed = true;
+
+    // Leave alone a signal stack set up by someone else.
+    stack_t stack;
+    if (sigaltstack(NULL, &stack) != 0 || !(stack.ss_flags & SS_DISABLE))
+    {
+        return;
+    }
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t size = __except_signal_stack_size();
+    char* memory = mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return;
+    }
+
+    stack = (stack_t){.ss_sp = memory + page, .ss_size = size - page};
+    if (mprotect(memory, page, PROT_NONE) != 0 || sigaltstack(&stack, NULL) != 0)
+    {
+        munmap(memory, size);
+        return;
+    }
+
+    call_once(&__except_once_flag, __except_one_time_init);
+    tss_set(__except_signal_stack_key, memory);
+
+#ifdef __GLIBC__
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+    {
+        void* address;
+        size_t stack_size;
+        pthread_attr_getstack(&attributes, &address, &stack_size);
+        pthread_attr_getguardsize(&attributes, &stack_guard);
+        pthread_attr_destroy(&attributes);
+
+        stack_low = address;
+        if (stack_guard < page)
+        {
+            stack_guard = page;
+        }
+    }
+#endif
+}
 
-static thread_local char current_exception[EXCEPT_MAX_THROWABLE_SIZE];
-static thread_local const char* current_id;
+// Whether a fault at address is an overflow of the thread stack. Faults up to a guard size away
+// from its end in either direction count, as the reported bounds may or may not include the guard.
+static bool __except_is_stack_overflow(const char* address)
+{
+    return stack_low != NULL && address >= stack_low - stack_guard &&
+           address < stack_low + stack_guard;
+}
 
 static void __except_handle_signal(int signal, siginfo_t* info, void* context)
 {
     (void)context;
 
+    // The signal stays blocked while its handler runs, and throwing never returns from the handler.
+    // Unblock it now, as try_fast blocks do not restore the signal mask when catching.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, signal);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    throw_from_handler = true;
+
     switch (signal)
     {
     case SIGFPE: {
@@ -86,6 +655,15 @@ static void __except_handle_signal(int signal, siginfo_t* info, void* context)
             throw(misaligned_access_error_t, error);
         }
     case SIGSEGV: {
+        if (signal == SIGSEGV && __except_is_stack_overflow(info->si_addr))
+        {
+            stack_corruption_error_t error = {
+                .message = "Stack overflow.",
+                .pc = info->si_addr,
+            };
+            throw(stack_corruption_error_t, error);
+        }
+
         access_violation_t error = {
             .message = "Access violation.",
             .address = info->si_addr,
@@ -118,8 +696,19 @@ static void __except_handle_signal(int signal, siginfo_t* info, void* context)
 
 void except_enable_sigcatch()
 {
+    // Resolving takes a lock, which must not happen in the signal handler.
+    __except_resolve(&__except_type_arithmetic_error_t);
+    __except_resolve(&__except_type_illegal_instruction_error_t);
+    __except_resolve(&__except_type_stack_corruption_error_t);
+    __except_resolve(&__except_type_access_violation_t);
+    __except_resolve(&__except_type_misaligned_access_error_t);
+
+    atomic_store_explicit(&__except_sigcatch, true, memory_order_relaxed);
+    __except_install_signal_stack();
+    __except_prepare_async();
+
     struct sigaction sa;
-    sa.sa_flags = SA_SIGINFO;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
     sa.sa_sigaction = __except_handle_signal;
     sigemptyset(&sa.sa_mask);
 
@@ -131,68 +720,474 @@ void except_enable_sigcatch()
 
 void except_disable_sigcatch()
 {
+    atomic_store_explicit(&__except_sigcatch, false, memory_order_relaxed);
+
     signal(SIGILL, SIG_DFL);
     signal(SIGFPE, SIG_DFL);
     signal(SIGSEGV, SIG_DFL);
     signal(SIGBUS, SIG_DFL);
 }
 
-jmp_buf** __except_current_context()
+// Every thread has a single timer, armed for the earliest of its deadlines. The depth counts the
+// try_with_deadline blocks the thread is in; a block only leaves if it is the innermost one.
+//
+// The timer is disarmed when leaving a block, so that its catch and finally clauses are not
+// interrupted, and armed again for the enclosing deadline once the block has completed. An expiry
+// while the block is handling an exception of its own is deferred until the handling completes.
+static once_flag __except_deadline_once_flag = ONCE_FLAG_INIT;
+static tss_t __except_deadline_key;
+static thread_local timer_t deadline_timer;
+static thread_local bool deadline_timer_created;
+static thread_local struct timespec deadline;
+static thread_local struct __except_record* deadline_current;
+static thread_local size_t deadline_depth;
+static thread_local bool deadline_rearm;
+static thread_local bool deadline_pending;
+
+static bool __except_timespec_before(const struct timespec* a, const struct timespec* b)
 {
-    static thread_local __EXCEPT_JMP_BUF* buffer;
-    return &buffer;
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
 }
 
-void __except_throw(const char* id, size_t exception_size, void* exception)
+static noreturn void __except_throw_timeout()
 {
-    // id is NULL only when rethrowing
-    if (id != NULL)
-    {
-        memcpy(current_exception, exception, exception_size);
-        current_id = id;
-    }
+    deadline_pending = false;
 
-    // Call the user defined handler if possible.
-    if (except_on_throw != NULL)
+    timeout_error_t error = {
+        .message = "Deadline exceeded.",
+    };
+    throw(timeout_error_t, error);
+}
+
+static void __except_handle_deadline(int signal, siginfo_t* info, void* context)
+{
+    (void)info;
+    (void)context;
+
+    // Expiries of deadlines that have been left or moved since are ignored.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (deadline_depth == 0 || __except_timespec_before(&now, &deadline))
     {
-        // Exceptions are not expected to be thrown.
-        __EXCEPT_TRY
-        {
-            except_on_throw(current_exception);
-        }
-        __EXCEPT_CATCH_ANY
-        {
-            __except_unexpected();
-        }
+        return;
     }
 
-    // If this is NULL then we have reached the end of the chain.
-    if (*__except_current_context() != NULL)
+    if (current != deadline_current)
     {
-        __EXCEPT_LONGJMP(**__except_current_context(), 1);
+        deadline_pending = true;
+        return;
     }
 
-    __except_unhandled();
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, signal);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    throw_from_handler = true;
+    __except_throw_timeout();
 }
 
-void __except_unhandled()
+static void __except_deadline_free(void* data)
 {
-    // Call the user provided handler if possible.
-    if (except_on_unhandled != NULL)
-    {
-        // Exceptions are not expected to be thrown.
-        __EXCEPT_TRY
-        {
-            except_on_unhandled(__except_current_exception());
-        }
-        __EXCEPT_CATCH_ANY
+    timer_delete(*(timer_t*)data);
+}
+
+static void __except_deadline_one_time_init()
+{
+    // Resolving takes a lock, which must not happen in the signal handler.
+    __except_resolve(&__except_type_timeout_error_t);
+
+    struct sigaction sa;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sa.sa_sigaction = __except_handle_deadline;
+    sigemptyset(&sa.sa_mask);
+
+    if (tss_create(&__except_deadline_key, __except_deadline_free) != thrd_success ||
+        sigaction(EXCEPT_DEADLINE_SIGNAL, &sa, NULL) != 0)
+    {
+        fputs("Could not initialize libexcept deadlines\n", stderr);
+        abort();
+    }
+}
+
+static void __except_deadline_create_timer()
+{
+    call_once(&__except_deadline_once_flag, __except_deadline_one_time_init);
+
+    struct sigevent event = {
+        .sigev_notify = SIGEV_THREAD_ID,
+        .sigev_signo = EXCEPT_DEADLINE_SIGNAL,
+    };
+    event.sigev_notify_thread_id = gettid();
+
+    if (timer_create(CLOCK_MONOTONIC, &event, &deadline_timer) != 0)
+    {
+        fputs("Could not create deadline timer\n", stderr);
+        abort();
+    }
+
+    // The timer itself may be 0, so its address is what marks it for deletion.
+    tss_set(__except_deadline_key, &deadline_timer);
+    deadline_timer_created = true;
+}
+
+// A zero time disarms the timer.
+static void __except_deadline_arm(const struct timespec* time)
+{
+    const struct itimerspec value = {.it_value = *time};
+    timer_settime(deadline_timer, TIMER_ABSTIME, &value, NULL);
+}
+
+// Called whenever a try block has completed.
+static void __except_deadline_resume()
+{
+    if (deadline_depth == 0 || current != deadline_current)
+    {
+        return;
+    }
+
+    if (deadline_pending)
+    {
+        __except_throw_timeout();
+    }
+
+    if (deadline_rearm)
+    {
+        deadline_rearm = false;
+        __except_deadline_arm(&deadline);
+    }
+}
+
+struct __except_deadline __except_deadline_enter(long ms)
+{
+    if (!deadline_timer_created)
+    {
+        __except_deadline_create_timer();
+    }
+
+    __except_prepare_async();
+
+    if (ms < 0)
+    {
+        ms = 0;
+    }
+
+    struct __except_deadline self = {
+        .previous = deadline,
+        .previous_current = deadline_current,
+        .depth = deadline_depth + 1,
+    };
+
+    clock_gettime(CLOCK_MONOTONIC, &self.deadline);
+    self.deadline.tv_sec += ms / 1000;
+    self.deadline.tv_nsec += ms % 1000 * 1000000;
+    if (self.deadline.tv_nsec >= 1000000000)
+    {
+        self.deadline.tv_sec++;
+        self.deadline.tv_nsec -= 1000000000;
+    }
+
+    // An enclosing deadline is never extended.
+    if (deadline_depth != 0 && __except_timespec_before(&deadline, &self.deadline))
+    {
+        self.deadline = deadline;
+    }
+
+    deadline = self.deadline;
+    deadline_current = current;
+    deadline_depth = self.depth;
+    return self;
+}
+
+int __except_deadline_start(const struct __except_deadline* self, int error)
+{
+    // The timer may already be armed for an inherited deadline.
+    if (error == 0 && (deadline_rearm || self->depth == 1 ||
+                       __except_timespec_before(&self->deadline, &self->previous)))
+    {
+        deadline_rearm = false;
+        __except_deadline_arm(&self->deadline);
+    }
+
+    return error;
+}
+
+int __except_deadline_step(const struct __except_deadline* self, int stage)
+{
+    if (stage == __EXCEPT_STAGE_TRY && deadline_depth == self->depth)
+    {
+        __except_deadline_arm(&(struct timespec){0});
+
+        deadline = self->previous;
+        deadline_current = self->previous_current;
+        deadline_depth--;
+        deadline_rearm = deadline_depth != 0;
+        deadline_pending = false;
+    }
+
+    return stage + 1;
+}
+
+__EXCEPT_JMP_BUF** __except_current_context()
+{
+    static thread_local __EXCEPT_JMP_BUF* buffer;
+    return &buffer;
+}
+
+struct __except_mark __except_arena_mark()
+{
+    if (!signal_stack_installed && atomic_load_explicit(&__except_sigcatch, memory_order_relaxed))
+    {
+        __except_install_signal_stack();
+        __except_prepare_async();
+    }
+
+    return (struct __except_mark){
+        .chunk = arena,
+        .used = arena == NULL ? 0 : arena->used,
+        .current = current,
+    };
+}
+
+void __except_arena_release(const struct __except_mark* mark)
+{
+    // Everything thrown since the mark has been handled, together with the causes it picked up.
+    for (struct __except_record* record = current; record != mark->current; record = record->cause)
+    {
+        if (!record->captured && record->type->_private.destroy != NULL)
+        {
+            record->type->_private.destroy(record->data);
+        }
+    }
+
+    current = mark->current;
+    __except_thrown = current == NULL ? NULL : current->type;
+
+    while (arena != mark->chunk)
+    {
+        struct __except_chunk* previous = arena->previous;
+        // Emergency chunks go back to the reserve as soon as they are no longer needed.
+        if (spare == NULL && arena->size == EXCEPT_ARENA_CHUNK_SIZE && !arena->emergency)
+        {
+            spare = arena;
+        }
+        else
+        {
+            __except_chunk_free(arena);
+        }
+        arena = previous;
+    }
+
+    if (arena != NULL)
+    {
+        arena->used = mark->used;
+    }
+
+    __except_deadline_resume();
+}
+
+void* except_alloc(size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    if (arena == NULL || arena->size - arena->used < size)
+    {
+        struct __except_chunk* chunk;
+        if (spare != NULL && size <= spare->size)
+        {
+            chunk = spare;
+            spare = NULL;
+        }
+        else
+        {
+            const size_t chunk_size =
+                size > EXCEPT_ARENA_CHUNK_SIZE ? size : EXCEPT_ARENA_CHUNK_SIZE;
+            chunk = malloc(sizeof(struct __except_chunk) + chunk_size);
+            if (chunk != NULL)
+            {
+                chunk->size = chunk_size;
+                chunk->emergency = false;
+            }
+            else if (size > EXCEPT_ARENA_CHUNK_SIZE || (chunk = __except_emergency_take()) == NULL)
+            {
+                fputs("Could not allocate exception arena\n", stderr);
+                abort();
+            }
+
+            // Make sure the arena is freed when the thread exits.
+            call_once(&__except_once_flag, __except_one_time_init);
+            tss_set(__except_arena_key, chunk);
+        }
+
+        chunk->used = 0;
+        chunk->previous = arena;
+        arena = chunk;
+    }
+
+    void* memory = (char*)arena->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+void* __except_new(except_type_t* type, size_t size)
+{
+    __except_resolve(type);
+
+    struct __except_record* record = except_alloc(sizeof(struct __except_record) + size);
+    record->type = type;
+    record->cause = NULL;
+    record->frames = NULL;
+    record->frame_count = 0;
+    record->unwound = 0;
+    record->caught = false;
+    record->captured = false;
+    record->size = size;
+    memset(record->data, 0, size);
+    return record->data;
+}
+
+static struct __except_record* __except_record_of(const void* exception)
+{
+    return (struct __except_record*)((char*)exception - offsetof(struct __except_record, data));
+}
+
+static noreturn void __except_propagate();
+
+// Runs the libdefer handlers of the functions a jump to context leaves.
+static void __except_unwind(__EXCEPT_JMP_BUF* context)
+{
+#ifdef EXCEPT_WITH_DEFER
+    __defer_unwind_to(context->frame);
+#else
+    (void)context;
+#endif
+}
+
+// Throws a newly allocated record. skip is the number of libexcept frames on top of the stack,
+// including this one, which are left out of the backtrace. site is where the throw was called.
+static noreturn void __except_raise(struct __except_record* record, size_t skip, void* site)
+{
+    const bool from_handler = throw_from_handler;
+    throw_from_handler = false;
+
+    // Nothing but try_result would see this exception, which only turns it into an error.
+    if (result_context != NULL && *__except_current_context() == result_context)
+    {
+        record->cause = current;
+        current = record;
+        __except_thrown = record->type;
+        __except_unwind(result_context);
+        __EXCEPT_LONGJMP(*result_context, 1);
+    }
+
+#ifdef EXCEPT_HAVE_EXECINFO
+    // Rethrown captured exceptions keep their original backtrace.
+    const size_t depth = atomic_load_explicit(&__except_backtrace_depth, memory_order_relaxed);
+    if (depth != 0 && record->frames == NULL)
+    {
+        record->frames = except_alloc((depth + skip) * sizeof(void*));
+        const size_t count = (size_t)backtrace(record->frames, (int)(depth + skip));
+        if (count > skip)
+        {
+            record->frames += skip;
+            record->frame_count = count - skip;
+        }
+    }
+#else
+    (void)skip;
+#endif
+
+    // Whatever is being handled right now is what caused this.
+    record->cause = current;
+    current = record;
+    __except_thrown = record->type;
+
+    __except_count(record->type, __EXCEPT_STAT_THROWS);
+    if (atomic_load_explicit(&__except_logging, memory_order_relaxed))
+    {
+        __except_log(record->type, site, from_handler);
+    }
+
+    __except_propagate();
+}
+
+void except_throw_new(void* exception)
+{
+    __except_raise(__except_record_of(exception), 2, __builtin_return_address(0));
+}
+
+void __except_throw(except_type_t* type, void* exception)
+{
+    // type is NULL only when propagating out of a try block
+    if (type != NULL)
+    {
+        void* copy = __except_new(type, type->size);
+        memcpy(copy, exception, type->size);
+        __except_raise(__except_record_of(copy), 2, __builtin_return_address(0));
+    }
+
+    // A catch clause that took the exception must have rethrown it.
+    if (current->caught)
+    {
+        current->caught = false;
+        __except_count(current->type, __EXCEPT_STAT_RETHROWS);
+    }
+
+    current->unwound++;
+    __except_propagate();
+}
+
+static noreturn void __except_propagate()
+{
+    // Call the user defined handler if possible.
+    void (*on_throw)(void*) = except_thread_on_throw != NULL ? except_thread_on_throw
+                                                              : except_on_throw;
+    if (on_throw != NULL)
+    {
+        // Exceptions are not expected to be thrown.
+        __EXCEPT_TRY_FAST
+        {
+            on_throw(current->data);
+        }
+        __EXCEPT_CATCH_ANY
+        {
+            __except_unexpected();
+        }
+    }
+
+    // If this is NULL then we have reached the end of the chain.
+    if (*__except_current_context() != NULL)
+    {
+        __except_unwind(*__except_current_context());
+        __EXCEPT_LONGJMP(**__except_current_context(), 1);
+    }
+
+    __except_unhandled();
+}
+
+void __except_unhandled()
+{
+    __except_count(current->type, __EXCEPT_STAT_UNHANDLED);
+
+    // Call the user provided handler if possible.
+    void (*on_unhandled)(void*) = except_thread_on_unhandled != NULL ? except_thread_on_unhandled
+                                                                      : except_on_unhandled;
+    if (on_unhandled != NULL)
+    {
+        // Exceptions are not expected to be thrown.
+        __EXCEPT_TRY_FAST
+        {
+            on_unhandled(__except_current_exception());
+        }
+        __EXCEPT_CATCH_ANY
         {
             __except_unexpected();
         }
     }
     else
     {
-        fprintf(stderr, "Unhandled exception of type \"%s\"\n", current_id);
+        fputs("Unhandled exception: ", stderr);
+        except_print(current->data, stderr);
     }
 
     thrd_exit(EXIT_FAILURE);
@@ -201,11 +1196,24 @@ void __except_unhandled()
 void __except_unexpected()
 {
     // Call the user provided handler if possible.
-    if (except_on_unexpected != NULL)
+    if (except_thread_on_unexpected != NULL)
+    {
+        __EXCEPT_TRY_FAST
+        {
+            except_thread_on_unexpected(current->data);
+        }
+        __EXCEPT_CATCH_ANY
+        {
+            // If an exception occurs, reset the handler and try again.
+            except_thread_on_unexpected = NULL;
+            __except_unexpected();
+        }
+    }
+    else if (except_on_unexpected != NULL)
     {
-        __EXCEPT_TRY
+        __EXCEPT_TRY_FAST
         {
-            except_on_unexpected(current_exception);
+            except_on_unexpected(current->data);
         }
         __EXCEPT_CATCH_ANY
         {
@@ -216,7 +1224,8 @@ void __except_unexpected()
     }
     else
     {
-        fprintf(stderr, "Unexpected exception of type \"%s\"\n", current_id);
+        fputs("Unexpected exception: ", stderr);
+        except_print(current->data, stderr);
     }
 
     thrd_exit(EXIT_FAILURE);
@@ -224,14 +1233,389 @@ void __except_unexpected()
 
 void* __except_current_exception()
 {
-    return current_exception;
+    return current->data;
+}
+
+void* except_current()
+{
+    return current == NULL ? NULL : current->data;
+}
+
+void* except_cause(const void* exception)
+{
+    struct __except_record* cause = __except_record_of(exception)->cause;
+    return cause == NULL ? NULL : cause->data;
+}
+
+const except_type_t* except_typeof(const void* exception)
+{
+    return __except_record_of(exception)->type;
+}
+
+int except_enable_backtrace(size_t depth)
+{
+#ifdef EXCEPT_HAVE_EXECINFO
+    // The first call loads the unwinder, which must not happen later in a signal handler.
+    void* frame;
+    backtrace(&frame, 1);
+
+    atomic_store_explicit(&__except_backtrace_depth,
+                          depth > EXCEPT_BACKTRACE_MAX ? EXCEPT_BACKTRACE_MAX : depth,
+                          memory_order_relaxed);
+    return 0;
+#else
+    (void)depth;
+    return ENOTSUP;
+#endif
+}
+
+void* const* except_backtrace(const void* exception, size_t* count)
+{
+    const struct __except_record* record = __except_record_of(exception);
+    *count = record->frame_count;
+    return record->frames;
+}
+
+static void __except_print_backtrace(const struct __except_record* record, FILE* stream)
+{
+#ifdef EXCEPT_HAVE_EXECINFO
+    if (record->frame_count == 0)
+    {
+        return;
+    }
+
+    char** symbols = backtrace_symbols(record->frames, (int)record->frame_count);
+    for (size_t i = 0; i < record->frame_count; i++)
+    {
+        if (symbols != NULL)
+        {
+            fprintf(stream, "\tat %s\n", symbols[i]);
+        }
+        else
+        {
+            fprintf(stream, "\tat %p\n", record->frames[i]);
+        }
+    }
+
+    free(symbols);
+#else
+    (void)record;
+    (void)stream;
+#endif
+}
+
+void except_print(const void* exception, FILE* stream)
+{
+    for (struct __except_record* record = __except_record_of(exception); record != NULL;
+         record = record->cause)
+    {
+        if (record != __except_record_of(exception))
+        {
+            fputs("Caused by: ", stream);
+        }
+
+        fputs(record->type->name, stream);
+        if (record->type->format != NULL)
+        {
+            fputs(": ", stream);
+            record->type->format(record->data, stream);
+        }
+        fputc('\n', stream);
+
+        __except_print_backtrace(record, stream);
+    }
+}
+
+except_captured_t __except_captured_new(except_type_t* type, const void* exception)
+{
+    __except_resolve(type);
+
+    struct __except_record* record = malloc(sizeof(struct __except_record) + type->size);
+    if (record == NULL)
+    {
+        fputs("Could not allocate exception\n", stderr);
+        abort();
+    }
+
+    *record = (struct __except_record){.type = type, .size = type->size};
+    memcpy(record->data, exception, type->size);
+    return (except_captured_t){._private.record = record};
+}
+
+void* except_captured(const except_captured_t* slot)
+{
+    return slot->_private.record == NULL ? NULL : slot->_private.record->data;
+}
+
+struct __except_result_frame __except_result_enter(__EXCEPT_JMP_BUF* buffer)
+{
+    const struct __except_result_frame frame = {
+        .context = *__except_current_context(),
+        .result = result_context,
+    };
+
+    *__except_current_context() = buffer;
+    __EXCEPT_CONTEXT_INIT(*buffer);
+    result_context = buffer;
+    return frame;
+}
+
+void __except_result_leave(const struct __except_result_frame* frame,
+                           const struct __except_mark* mark,
+                           except_captured_t* error)
+{
+    *__except_current_context() = frame->context;
+    result_context = frame->result;
+
+    if (error == NULL)
+    {
+        return;
+    }
+
+    if (except_capture(error) != 0)
+    {
+        fputs("Could not capture exception: ", stderr);
+        except_print(current->data, stderr);
+        abort();
+    }
+
+    __except_arena_release(mark);
+}
+
+int except_capture(except_captured_t* slot)
+{
+    if (current == NULL)
+    {
+        return EINVAL;
+    }
+
+    // The backtrace is kept after the payload, which leaves it suitably aligned.
+    const size_t frames_size = current->frame_count * sizeof(void*);
+    struct __except_record* record =
+        malloc(sizeof(struct __except_record) + current->size + frames_size);
+    if (record == NULL)
+    {
+        return ENOMEM;
+    }
+
+    memcpy(record, current, sizeof(struct __except_record) + current->size);
+    record->cause = NULL;
+    record->frames = NULL;
+    if (frames_size != 0)
+    {
+        record->frames = (void**)((char*)record->data + current->size);
+        memcpy(record->frames, current->frames, frames_size);
+    }
+
+    // The payload belongs to the copy now.
+    current->captured = true;
+    slot->_private.record = record;
+    return 0;
+}
+
+void except_rethrow(except_captured_t* slot)
+{
+    struct __except_record* captured = slot->_private.record;
+    if (captured == NULL)
+    {
+        return;
+    }
+
+    slot->_private.record = NULL;
+
+    void* exception = __except_new(captured->type, captured->size);
+    struct __except_record* record = __except_record_of(exception);
+    memcpy(record->data, captured->data, captured->size);
+    if (captured->frame_count != 0)
+    {
+        record->frames = except_alloc(captured->frame_count * sizeof(void*));
+        memcpy(record->frames, captured->frames, captured->frame_count * sizeof(void*));
+        record->frame_count = captured->frame_count;
+    }
+
+    free(captured);
+    __except_raise(record, 2, __builtin_return_address(0));
+}
+
+void except_discard(except_captured_t* slot)
+{
+    struct __except_record* record = slot->_private.record;
+    if (record == NULL)
+    {
+        return;
+    }
+
+    slot->_private.record = NULL;
+
+    __except_resolve(record->type);
+    if (record->type->_private.destroy != NULL)
+    {
+        record->type->_private.destroy(record->data);
+    }
+
+    free(record);
+}
+
+static noreturn void __except_out_of_memory(size_t size)
+{
+    out_of_memory_error_t error = {.message = "Out of memory.", .size = size};
+    throw(out_of_memory_error_t, error);
 }
 
-int __except_personality(const char* id)
+void* except_malloc(size_t size)
 {
-    return strcmp(current_id, id) == 0;
+    void* memory = malloc(size);
+    if (memory == NULL && size != 0)
+    {
+        __except_out_of_memory(size);
+    }
+
+    return memory;
+}
+
+void* except_realloc(void* ptr, size_t size)
+{
+    void* memory = realloc(ptr, size);
+    if (memory == NULL && size != 0)
+    {
+        __except_out_of_memory(size);
+    }
+
+    return memory;
+}
+
+static int __except_future_run(void* data)
+{
+    except_future_t* self = data;
+
+    __EXCEPT_TRY_FAST
+    {
+        self->_private.result = self->_private.function(self->_private.argument);
+    }
+    __EXCEPT_CATCH_ANY
+    {
+        if (except_capture(&self->_private.error) != 0)
+        {
+            fputs("Could not capture exception: ", stderr);
+            except_print(current->data, stderr);
+            abort();
+        }
+    }
+
+    return 0;
+}
+
+int except_future_start(except_future_t* self, thrd_start_t function, void* argument)
+{
+    self->_private.function = function;
+    self->_private.argument = argument;
+    self->_private.result = 0;
+    self->_private.error._private.record = NULL;
+
+    switch (thrd_create(&self->_private.thread, __except_future_run, self))
+    {
+    case thrd_success:
+        return 0;
+    case thrd_nomem:
+        return ENOMEM;
+    default:
+        return EAGAIN;
+    }
+}
+
+int except_future_join(except_future_t* self)
+{
+    thrd_join(self->_private.thread, NULL);
+    except_rethrow(&self->_private.error);
+    return self->_private.result;
+}
+
+int __except_instance_of(except_type_t* type)
+{
+    const except_type_t* thrown = current->type;
+    if (thrown == type)
+    {
+        return 1;
+    }
+
+    // The thrown type was resolved when thrown.
+    __except_resolve(type);
+    const size_t depth = type->_private.depth;
+    return thrown->_private.depth > depth && thrown->_private.ancestors[depth] == type;
+}
+
+int __except_personality(except_type_t* type)
+{
+    // type is NULL for clauses that have already matched.
+    if (type != NULL && !__except_instance_of(type))
+    {
+        return 0;
+    }
+
+    current->caught = true;
+    __except_count(current->type, __EXCEPT_STAT_CATCHES);
+    __except_count_depth(current->unwound);
+    return 1;
+}
+
+void except_stats_dump(FILE* stream)
+{
+    struct __except_stats* total = calloc(1, sizeof(struct __except_stats));
+    if (total == NULL)
+    {
+        return;
+    }
+
+    call_once(&__except_once_flag, __except_one_time_init);
+    mtx_lock(&__except_lock);
+
+    __except_stats_add(total, &__except_stats_retired);
+    for (struct __except_stats* thread = __except_stats_live; thread != NULL; thread = thread->next)
+    {
+        __except_stats_add(total, thread);
+    }
+
+    fputs("type throws catches rethrows unhandled\n", stream);
+    for (size_t i = 0; i < EXCEPT_STATS_TYPES_MAX; i++)
+    {
+        uint_fast64_t counts[__EXCEPT_STAT_COUNT];
+        for (size_t j = 0; j < __EXCEPT_STAT_COUNT; j++)
+        {
+            counts[j] = atomic_load_explicit(&total->counts[i][j], memory_order_relaxed);
+        }
+
+        if (counts[__EXCEPT_STAT_THROWS] == 0)
+        {
+            continue;
+        }
+
+        fprintf(stream,
+                "%s %" PRIuFAST64 " %" PRIuFAST64 " %" PRIuFAST64 " %" PRIuFAST64 "\n",
+                i < __except_type_count ? __except_types[i]->name : "(other)",
+                counts[__EXCEPT_STAT_THROWS],
+                counts[__EXCEPT_STAT_CATCHES],
+                counts[__EXCEPT_STAT_RETHROWS],
+                counts[__EXCEPT_STAT_UNHANDLED]);
+    }
+
+    fputs("depth catches\n", stream);
+    for (size_t i = 0; i < EXCEPT_STATS_DEPTH_MAX; i++)
+    {
+        const uint_fast64_t count = atomic_load_explicit(&total->depths[i], memory_order_relaxed);
+        if (count != 0)
+        {
+            const char* suffix = i == EXCEPT_STATS_DEPTH_MAX - 1 ? "+" : "";
+            fprintf(stream, "%zu%s %" PRIuFAST64 "\n", i, suffix, count);
+        }
+    }
+
+    mtx_unlock(&__except_lock);
+    free(total);
 }
 
 void (*except_on_throw)(void*);
 void (*except_on_unhandled)(void*);
 void (*except_on_unexpected)(void*);
+thread_local void (*except_thread_on_throw)(void*);
+thread_local void (*except_thread_on_unhandled)(void*);
+thread_local void (*except_thread_on_unexpected)(void*);
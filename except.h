@@ -41,23 +41,40 @@
  * - Do not use break, continue, return, goto or other ways to exit try/catch/finally blocks.
  * - Do not use anything beginning with __except.
  *
- * For optimal debugging experience this library can be combined with Ian Lance Taylor's
- * libbacktrace (https://github.com/ianlancetaylor/libbacktrace) to attach backtraces to thrown
- * exceptions. Glibc also provides backtrace support via the execinfo.h header.
+ * When built with EXCEPT_HAVE_EXECINFO defined, libexcept can record where exceptions are thrown
+ * using the backtrace support of execinfo.h (see except_enable_backtrace). For better symbolization
+ * the recorded addresses can be passed to Ian Lance Taylor's libbacktrace
+ * (https://github.com/ianlancetaylor/libbacktrace).
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdnoreturn.h>
+#include <threads.h>
+#include <time.h>
+
+#ifdef EXCEPT_WITH_DEFER
+#include "defer.h"
+#endif
 
 /**
  * @defgroup keywords Exception handling keywords.
  *
  * try: Begins a code block from which exceptions are expected to be thrown.
+ * try_fast: Like try, but does not save the signal mask on entry (see below).
+ * try_masked: Like try, but always saves the signal mask on entry, even with EXCEPT_FAST_TRY.
+ * try_with_deadline(ms): Like try_fast, but throws timeout_error_t if the block runs for longer
+ *                        than ms milliseconds.
  * catch: Follows a try block and only executes when an exception of the specified type is thrown.
  * catch_any: Similar to a catch block except it matches every thrown object.
+ * catch_one_of: Matches any of up to EXCEPT_CATCH_TYPES_MAX types, as in
+ *               catch_one_of (error, io_error_t, parse_error_t). The variable is a void* pointing
+ *               to the exception, whose type can be queried with except_typeof.
  * finally: Follows a try block and is always executed. This is useful for cleaning up resources.
  *
  * catch/finally blocks are only required to come after a try block but not in a specific order. In
@@ -87,19 +104,59 @@
  * @endcode
  *
  * catch clauses are, however, searched in the order they are declared. This has the effect that
- * catch_any must be the last in line because it matches every thrown object.
+ * catch_any must be the last in line because it matches every thrown object. Clauses are matched
+ * inline against the type descriptor of the thrown object, so a clause that does not match costs
+ * a few memory loads and no function call.
+ *
+ * By default entering a try block saves the signal mask, which costs a system call, so that it is
+ * restored when an exception is caught. try_fast blocks only save registers and are much cheaper
+ * to enter. They still catch exceptions thrown from signal handlers, since the handler unblocks its
+ * signal before throwing, but any other changes to the signal mask made inside the block are kept
+ * when an exception is caught. Defining EXCEPT_FAST_TRY makes every try block a try_fast block, in
+ * which case try_masked selects the mask-saving behavior.
+ *
+ * A try_with_deadline block arms a timer of the calling thread on entry and disarms it when the
+ * block completes or throws, before any catch or finally clause runs. This takes two system calls.
+ * On expiry the timer sends EXCEPT_DEADLINE_SIGNAL to the thread, whose handler throws
+ * timeout_error_t from wherever the block is executing. Like any exception it is caught by the
+ * innermost enclosing try block. Nested deadlines never extend the deadline of an enclosing block.
+ * The code in the block should therefore be prepared for being interrupted at any point, much like
+ * code that may raise signals caught with except_enable_sigcatch. Entering the block sets up the
+ * per-thread state a throw needs, so the handler itself neither allocates nor takes a lock.
+ *
+ * @code
+ *
+ * try_with_deadline (100)
+ * {
+ *     result = evaluate(untrusted_expression);
+ * }
+ * catch (timeout_error_t, error)
+ * {
+ *     result = NULL;
+ * }
+ *
+ * @endcode
  *
  * throw: Throws an exception. Execution of the current function immediately halts.
  * rethrow: Re-throws an exception caught in a catch block. This will preserve the original
  *          exception object.
  *
+ * When libexcept and all code using it are built with EXCEPT_WITH_DEFER, a throw runs the libdefer
+ * handlers of every function it leaves, innermost first, before the catching try block resumes.
+ * Otherwise those handlers are skipped.
+ *
  * If any of these keyword macros interfere with other symbol names, you may choose to prevent their
  * definition. This can be done by defining the EXCEPT_NO_KEYWORDS macro. The same constructs can
  * be used under the following names:
  *
  * __EXCEPT_TRY
+ * __EXCEPT_TRY_FAST
+ * __EXCEPT_TRY_MASKED
+ * __EXCEPT_TRY_DEADLINE
+ * __EXCEPT_TRY_RESULT
  * __EXCEPT_CATCH
  * __EXCEPT_CATCH_ANY
+ * __EXCEPT_CATCH_ONE_OF
  * __EXCEPT_FINALLY
  * __EXCEPT_THROW
  * __EXCEPT_RETHROW
@@ -109,8 +166,12 @@
 
 #ifndef EXCEPT_NO_KEYWORDS
 #define try __EXCEPT_TRY
+#define try_fast   __EXCEPT_TRY_FAST
+#define try_masked __EXCEPT_TRY_MASKED
+#define try_with_deadline __EXCEPT_TRY_DEADLINE
 #define catch __EXCEPT_CATCH
 #define catch_any __EXCEPT_CATCH_ANY
+#define catch_one_of __EXCEPT_CATCH_ONE_OF
 #define finally   __EXCEPT_FINALLY
 #define throw __EXCEPT_THROW
 #define rethrow __EXCEPT_RETHROW
@@ -121,15 +182,238 @@
  */
 
 /**
- * The maximum size of an object allowed to be thrown.
+ * The maximum number of types a catch_one_of clause can match.
+ */
+#define EXCEPT_CATCH_TYPES_MAX 8
+
+/**
+ * The size of the memory blocks the per-thread exception arena allocates from.
+ */
+#define EXCEPT_ARENA_CHUNK_SIZE 4096
+
+/**
+ * The number of arena chunks reserved up front for all threads, which the arena falls back to
+ * when memory is exhausted so that out_of_memory_error_t can still be thrown.
+ */
+#define EXCEPT_EMERGENCY_CHUNKS 8
+
+/**
+ * The size of the per-thread stack that signals are handled on when caught by libexcept.
+ */
+#define EXCEPT_SIGNAL_STACK_SIZE 65536
+
+/**
+ * The signal used to interrupt try_with_deadline blocks.
+ */
+#ifndef EXCEPT_DEADLINE_SIGNAL
+#define EXCEPT_DEADLINE_SIGNAL (SIGRTMIN + 4)
+#endif
+
+/**
+ * The number of entries in the throw log of each thread. Must be a power of 2.
+ */
+#define EXCEPT_LOG_SIZE 256
+
+/**
+ * The maximum number of return addresses recorded per thrown exception.
+ */
+#define EXCEPT_BACKTRACE_MAX 64
+
+/**
+ * The number of exception types tracked individually by the statistics. Further types are counted
+ * together.
+ */
+#define EXCEPT_STATS_TYPES_MAX 256
+
+/**
+ * The number of try blocks unwound per throw that the statistics distinguish. Longer unwinds are
+ * counted together.
+ */
+#define EXCEPT_STATS_DEPTH_MAX 16
+
+/**
+ * The maximum depth of an exception type hierarchy, counting the root type.
+ */
+#define EXCEPT_DEPTH_MAX 8
+
+/**
+ * Describes a type that can be thrown.
+ *
+ * Every throwable type has exactly one descriptor, so catch clauses match thrown exceptions by
+ * comparing descriptor addresses, regardless of the length of the type's name. Descriptors for the
+ * scalar types and the error types declared in this file are provided by libexcept. Any other type
+ * must be declared with EXCEPT_DECLARE wherever it is thrown or caught and defined exactly once
+ * with EXCEPT_DEFINE:
+ *
+ * @code
+ *
+ * // parse.h
+ * typedef struct
+ * {
+ *     int line;
+ *     char* message;
+ * } parse_error_t;
+ *
+ * EXCEPT_DECLARE(parse_error_t);
+ *
+ * // parse.c
+ * static void parse_error_destroy(void* error)
+ * {
+ *     free(((parse_error_t*)error)->message);
+ * }
+ *
+ * EXCEPT_DEFINE_DESTROY(parse_error_t, parse_error_destroy);
+ *
+ * @endcode
+ *
+ * Types must be named with a single identifier, so for example unsigned int can be thrown as
+ * unsigned but a pointer type needs a typedef. A typedef of a scalar type is matched as that scalar
+ * type and only needs to be declared, not defined.
+ *
+ * Types can be arranged in hierarchies with EXCEPT_DEFINE_DERIVED. A catch clause for a type also
+ * catches all types derived from it, and checking this takes constant time regardless of the depth
+ * of the hierarchy. A derived type should begin with the members of its parent, so that the caught
+ * object is meaningful when viewed as the parent type:
+ *
+ * @code
+ *
+ * typedef struct
+ * {
+ *     int fd;
+ * } io_error_t;
+ *
+ * typedef struct
+ * {
+ *     int fd;
+ *     size_t offset;
+ * } read_error_t;
+ *
+ * EXCEPT_DEFINE(io_error_t);
+ * EXCEPT_DEFINE_DERIVED(read_error_t, io_error_t);
+ *
+ * try { ... }
+ * catch (io_error_t, error) { ... } // Also catches read_error_t.
+ *
+ * @endcode
+ *
+ * except_type_t members other than those documented are considered private.
+ */
+typedef struct except_type
+{
+    /**
+     * The name of the type.
+     */
+    const char* name;
+
+    /**
+     * The size of the type.
+     */
+    size_t size;
+
+    /**
+     * Called on a thrown object once it has been handled, or NULL to use the parent's destructor.
+     */
+    void (*destroy)(void* exception);
+
+    /**
+     * The parent type, or NULL.
+     */
+    struct except_type* parent;
+
+    /**
+     * Writes a description of a thrown object, or NULL to only print the type name. This is only
+     * called when the exception is printed, so any expensive formatting can be deferred to it.
+     */
+    void (*format)(const void* exception, FILE* stream);
+
+    struct
+    {
+        atomic_bool resolved;
+        size_t depth;
+        struct except_type* ancestors[EXCEPT_DEPTH_MAX];
+        void (*destroy)(void* exception);
+        size_t id;
+    } _private;
+} except_type_t;
+
+/**
+ * Declares the descriptor of a throwable type.
+ *
+ * @param T The type, which must be a single identifier.
+ */
+#define EXCEPT_DECLARE(T) extern except_type_t __except_type_##T
+
+/**
+ * Defines the descriptor of a throwable type. This must be done in exactly one source file.
+ *
+ * @param T The type, which must be a single identifier.
+ */
+#define EXCEPT_DEFINE(T) __EXCEPT_DEFINE(T, NULL, NULL)
+
+/**
+ * Defines the descriptor of a throwable type that needs to be cleaned up.
+ *
+ * The destructor runs once a thrown object of the type has been handled, that is after the last
+ * catch clause that caught it completes without rethrowing it. Objects that are never caught are
+ * not destroyed.
+ *
+ * @param T The type, which must be a single identifier.
+ * @param destructor A function taking a pointer to the thrown object.
+ */
+#define EXCEPT_DEFINE_DESTROY(T, destructor) __EXCEPT_DEFINE(T, NULL, destructor)
+
+/**
+ * Defines the descriptor of a throwable type derived from another one.
+ *
+ * @param T The type, which must be a single identifier.
+ * @param Parent The parent type, which must have been declared.
+ */
+#define EXCEPT_DEFINE_DERIVED(T, Parent) __EXCEPT_DEFINE(T, &__except_type_##Parent, NULL)
+
+/**
+ * Defines the descriptor of a throwable type derived from another one that needs to be cleaned up.
+ *
+ * @param T The type, which must be a single identifier.
+ * @param Parent The parent type, which must have been declared.
+ * @param destructor A function taking a pointer to the thrown object.
+ *
+ * @see EXCEPT_DEFINE_DESTROY
+ */
+#define EXCEPT_DEFINE_DERIVED_DESTROY(T, Parent, destructor)                                       \
+    __EXCEPT_DEFINE(T, &__except_type_##Parent, destructor)
+
+/**
+ * Defines the descriptor of a throwable type with additional properties.
+ *
+ * @code
+ *
+ * EXCEPT_DEFINE_EX(parse_error_t,
+ *                  .parent = EXCEPT_TYPE(io_error_t),
+ *                  .destroy = parse_error_destroy,
+ *                  .format = parse_error_format);
+ *
+ * @endcode
+ *
+ * @param T The type, which must be a single identifier.
+ * @param ... Designated initializers for the members of except_type_t.
  */
-#define EXCEPT_MAX_THROWABLE_SIZE 128
+#define EXCEPT_DEFINE_EX(T, ...)                                                                   \
+    except_type_t __except_type_##T = {.name = #T, .size = sizeof(T), __VA_ARGS__}
+
+/**
+ * Returns the descriptor of a throwable type.
+ *
+ * @param T The type.
+ * @return A pointer to the descriptor.
+ */
+#define EXCEPT_TYPE(T) __EXCEPT_TYPE(T)
 
 /**
  * @defgroup event_hooks Event hooks.
  *
  * libexcept provides hooks for some events. They are global to the program and not thread-safe to
- * set or unset. They are intended to be set just after entering main.
+ * set or unset. They are intended to be set just after entering main. Each hook can be overridden
+ * for the calling thread by its except_thread_ counterpart, which can be set at any time.
  *
  * The default implementations just print a simple message to stderr. To restore the default
  * implementations just set these back to NULL.
@@ -164,12 +448,499 @@ extern void (*except_on_unhandled)(void* exception);
  */
 extern void (*except_on_unexpected)(void* exception);
 
+/**
+ * Overrides except_on_throw for the calling thread, unless NULL.
+ */
+extern thread_local void (*except_thread_on_throw)(void* exception);
+
+/**
+ * Overrides except_on_unhandled for the calling thread, unless NULL.
+ */
+extern thread_local void (*except_thread_on_unhandled)(void* exception);
+
+/**
+ * Overrides except_on_unexpected for the calling thread, unless NULL.
+ */
+extern thread_local void (*except_thread_on_unexpected)(void* exception);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup log Throw log.
+ *
+ * A cheap alternative to logging from except_on_throw. Each thread records its throws in a ring
+ * buffer of EXCEPT_LOG_SIZE entries that only it writes to, without locking or calling into stdio.
+ * A single reader at a time, typically a background thread, drains the buffers of all threads.
+ * Throws are dropped rather than waiting when the buffer of a thread is full.
+ *
+ * @code
+ *
+ * except_enable_log(true);
+ * ...
+ * except_log_entry_t entries[64];
+ * size_t count;
+ * while ((count = except_log_drain(entries, 64)) != 0)
+ * {
+ *     for (size_t i = 0; i < count; i++)
+ *     {
+ *         fprintf(log, "%s thrown at %p\n", entries[i].type->name, entries[i].site);
+ *     }
+ * }
+ *
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * A logged throw.
+ */
+typedef struct
+{
+    /**
+     * When the exception was thrown, from timespec_get with TIME_UTC.
+     */
+    struct timespec time;
+
+    /**
+     * The type of the exception.
+     */
+    const except_type_t* type;
+
+    /**
+     * The return address of the call that threw the exception.
+     */
+    void* site;
+
+    /**
+     * The number of throws the thread dropped just before this one because its log was full or
+     * not set up yet.
+     */
+    size_t dropped;
+} except_log_entry_t;
+
+/**
+ * Starts or stops logging throws. Rethrows are not logged.
+ *
+ * Each thread sets up its log on its first logged throw, or on entering a try_with_deadline block
+ * or installing its signal stack while logging is enabled. Throws from signal and deadline
+ * handlers cannot set up the log, so in a thread without one they are only counted as dropped.
+ * Enable logging before starting such threads to log these throws too.
+ *
+ * @param enable Whether to log.
+ */
+void except_enable_log(bool enable);
+
+/**
+ * Takes logged throws out of the logs of all threads.
+ *
+ * Entries of the same thread are returned in the order they were thrown. The logs of threads that
+ * have exited are freed once drained. Calls from different threads are serialized.
+ *
+ * @param entries Where to store the entries.
+ * @param count The maximum number of entries to take.
+ * @return The number of entries taken, 0 if the logs are empty.
+ */
+size_t except_log_drain(except_log_entry_t* entries, size_t count);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup arena Exception storage.
+ *
+ * Thrown objects live in a per-thread arena rather than a fixed buffer, so they can be of any size
+ * and can refer to other memory in the arena. Memory is bump allocated and released all at once
+ * when the try block that caught the exception completes, which also runs the destructors of the
+ * exception and its causes.
+ *
+ * An exception thrown while another one is being handled, that is from a try block nested in a
+ * catch clause, keeps the handled one alive as its cause:
+ *
+ * @code
+ *
+ * try { ... }
+ * catch (io_error_t, error)
+ * {
+ *     try
+ *     {
+ *         retry();
+ *     }
+ *     catch_any
+ *     {
+ *         except_print(except_current(), stderr); // Prints the new exception, then the io_error_t.
+ *     }
+ * }
+ *
+ * @endcode
+ *
+ * The same goes for exceptions thrown from catch clauses, which are reported to
+ * except_on_unexpected together with their cause.
+ *
+ * @{
+ */
+
+/**
+ * Allocates memory that lives as long as an exception thrown from the current try block.
+ *
+ * The memory is released when the innermost enclosing try block completes, unless an exception
+ * propagates out of it, in which case it is released by the try block that catches the exception.
+ * This is useful for messages and other data referred to by thrown objects.
+ *
+ * When memory is exhausted, chunks of up to EXCEPT_ARENA_CHUNK_SIZE bytes are taken from an
+ * emergency reserve of EXCEPT_EMERGENCY_CHUNKS chunks shared by all threads.
+ *
+ * @param size The number of bytes to allocate.
+ * @return The memory, suitably aligned for any type. The program is aborted if allocation fails
+ *         and the emergency reserve is exhausted.
+ */
+void* except_alloc(size_t size);
+
+/**
+ * Allocates an exception of a type with a flexible array member.
+ *
+ * The object is zero initialized and can be thrown with except_throw_new.
+ *
+ * @code
+ *
+ * message_error_t* error = EXCEPT_NEW(message_error_t, strlen(message) + 1);
+ * strcpy(error->message, message);
+ * except_throw_new(error);
+ *
+ * @endcode
+ *
+ * @param T The type.
+ * @param extra The number of bytes needed beyond sizeof(T).
+ * @return A pointer to the new object.
+ */
+#define EXCEPT_NEW(T, extra) ((T*)__except_new(__EXCEPT_TYPE(T), sizeof(T) + (extra)))
+
+/**
+ * Throws an exception allocated with EXCEPT_NEW.
+ *
+ * @param exception The exception.
+ */
+noreturn void except_throw_new(void* exception);
+
+/**
+ * Returns the exception currently being handled.
+ *
+ * Inside a catch clause this is the caught exception. Unlike the variable of the catch clause it
+ * refers to the complete thrown object.
+ *
+ * @return The exception, or NULL if none is being handled.
+ */
+void* except_current();
+
+/**
+ * Returns the exception that was being handled when an exception was thrown.
+ *
+ * @param exception The exception.
+ * @return The cause, or NULL.
+ */
+void* except_cause(const void* exception);
+
+/**
+ * Returns the type of a thrown exception.
+ *
+ * @param exception The exception.
+ * @return The type descriptor.
+ */
+const except_type_t* except_typeof(const void* exception);
+
+/**
+ * Prints statistics about the exceptions thrown so far by all threads.
+ *
+ * For every exception type that was thrown, this prints how many times it was thrown, caught,
+ * rethrown from a catch clause and left unhandled, followed by a histogram of the number of try
+ * blocks each caught exception propagated through before being caught. Counting is always on and
+ * costs a few uncontended memory accesses per event, as every thread keeps its own counters. They
+ * are only summed up here, so the output may miss events that happen concurrently with the call.
+ *
+ * @code
+ *
+ * type throws catches rethrows unhandled
+ * parse_error_t 1200 1200 0 0
+ * depth catches
+ * 0 1150
+ * 1 50
+ *
+ * @endcode
+ *
+ * @param stream The stream to print to.
+ */
+void except_stats_dump(FILE* stream);
+
+/**
+ * Starts or stops recording backtraces of thrown exceptions.
+ *
+ * Only raw return addresses are recorded when throwing, which takes roughly as long as unwinding
+ * the same number of frames, so this can be left enabled in production. They are translated to
+ * symbol names only when an exception is printed, including when it is unhandled.
+ *
+ * @param depth The maximum number of frames to record, at most EXCEPT_BACKTRACE_MAX. 0 stops
+ *              recording.
+ * @return 0 on success, ENOTSUP if libexcept was built without EXCEPT_HAVE_EXECINFO.
+ */
+int except_enable_backtrace(size_t depth);
+
+/**
+ * Returns the return addresses recorded when an exception was thrown.
+ *
+ * @param exception The exception.
+ * @param count Set to the number of addresses, which is 0 if none were recorded.
+ * @return The addresses, innermost first.
+ */
+void* const* except_backtrace(const void* exception, size_t* count);
+
+/**
+ * Prints an exception and its chain of causes.
+ *
+ * Each exception is printed using the format function of its type, if any, followed by its
+ * backtrace if one was recorded.
+ *
+ * @param exception The exception.
+ * @param stream The stream to print to.
+ */
+void except_print(const void* exception, FILE* stream);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup capture Propagation between threads.
+ *
+ * An exception that escapes the function of a thread is unhandled and ends the thread, without
+ * telling anyone why. Capturing moves the exception out of the arena of its thread so that it can
+ * be rethrown in another one, with its original backtrace:
+ *
+ * @code
+ *
+ * except_future_t future;
+ * except_future_start(&future, parse_file, "data.txt");
+ * ...
+ * try
+ * {
+ *     int result = except_future_join(&future);
+ * }
+ * catch (parse_error_t, error) { ... } // Thrown by parse_file in the other thread.
+ *
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * Holds a captured exception. A zero initialized object holds none.
+ */
+typedef struct
+{
+    struct
+    {
+        struct __except_record* record;
+    } _private;
+} except_captured_t;
+
+/**
+ * A thread whose uncaught exception is rethrown by the thread joining it.
+ */
+typedef struct
+{
+    struct
+    {
+        thrd_t thread;
+        thrd_start_t function;
+        void* argument;
+        int result;
+        except_captured_t error;
+    } _private;
+} except_future_t;
+
+/**
+ * Moves the exception currently being handled into a captured object.
+ *
+ * The exception is no longer destroyed when its catch clause completes; that happens when it is
+ * rethrown and caught again, or discarded. Its causes are not captured. The payload is copied
+ * bytewise, so it must not refer to memory in the arena, such as memory from except_alloc.
+ *
+ * @param slot An empty captured object.
+ * @return 0 on success, EINVAL if no exception is being handled, ENOMEM if out of memory.
+ */
+int except_capture(except_captured_t* slot);
+
+/**
+ * Throws a captured exception in the calling thread, which may differ from the capturing one.
+ *
+ * The captured object is empty afterwards. Nothing happens if it is already empty.
+ *
+ * @param slot The captured object.
+ */
+void except_rethrow(except_captured_t* slot);
+
+/**
+ * Destroys a captured exception without throwing it. The captured object is empty afterwards.
+ *
+ * @param slot The captured object.
+ */
+void except_discard(except_captured_t* slot);
+
+/**
+ * Starts a thread whose uncaught exception is captured for except_future_join.
+ *
+ * @param self The future.
+ * @param function The function to run in the new thread.
+ * @param argument The argument to pass to the function.
+ * @return 0 on success, ENOMEM if out of memory, EAGAIN if the thread could not be created.
+ */
+int except_future_start(except_future_t* self, thrd_start_t function, void* argument);
+
+/**
+ * Waits for the thread of a future to finish.
+ *
+ * If its function threw an exception, the exception is rethrown in the calling thread.
+ *
+ * @param self The future.
+ * @return The value returned by the function.
+ */
+int except_future_join(except_future_t* self);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup result Error results.
+ *
+ * Functions that report expected failures, such as parse errors, can return a result holding
+ * either a value or an error instead of throwing. The error is a captured exception, so failing
+ * costs an allocation rather than a throw, and the caller handles it with an ordinary branch:
+ *
+ * @code
+ *
+ * EXCEPT_RESULT_DECLARE(int);
+ *
+ * EXCEPT_RESULT(int) parse_digit(char c)
+ * {
+ *     if (c < '0' || c > '9')
+ *     {
+ *         return EXCEPT_ERROR(int, parse_error_t, .position = 0);
+ *     }
+ *     return EXCEPT_OK(int, c - '0');
+ * }
+ *
+ * EXCEPT_RESULT(int) digit = parse_digit(c);
+ * if (!EXCEPT_RESULT_OK(digit))
+ * {
+ *     parse_error_t* error = except_captured(&digit.error);
+ *     ...
+ *     except_discard(&digit.error);
+ * }
+ *
+ * @endcode
+ *
+ * try_result converts the other way, calling a function that throws and turning the exception it
+ * throws into a result. Only throws that are not caught inside the function take a shortcut: they
+ * skip the hooks, statistics, throw log and backtrace, and jump straight back to try_result, whose
+ * entry only saves registers like try_fast. EXCEPT_UNWRAP throws the error of a result as a normal
+ * exception.
+ *
+ * @code
+ *
+ * EXCEPT_RESULT(int) value = try_result(int, parse_int_or_throw(text));
+ * int checked = EXCEPT_UNWRAP(value);
+ *
+ * @endcode
+ *
+ * try_result relies on statement expressions, which GCC and Clang support. Like for EXCEPT_TYPE,
+ * the value type must be a single identifier.
+ *
+ * @{
+ */
+
+/**
+ * The type of a result holding either a value of type T or a captured exception.
+ *
+ * @param T The value type.
+ */
+#define EXCEPT_RESULT(T) struct __except_result_##T
+
+/**
+ * Defines EXCEPT_RESULT(T). It must appear once before EXCEPT_RESULT(T) is used, usually in a
+ * header. The result has two members: value, which is only meaningful on success, and error.
+ *
+ * @param T The value type.
+ */
+#define EXCEPT_RESULT_DECLARE(T)                                                                   \
+    EXCEPT_RESULT(T)                                                                               \
+    {                                                                                              \
+        T value;                                                                                   \
+        except_captured_t error;                                                                   \
+    }
+
+/**
+ * Creates a successful result.
+ *
+ * @param T The value type.
+ * @param ... The value.
+ */
+#define EXCEPT_OK(T, ...) ((EXCEPT_RESULT(T)){.value = __VA_ARGS__})
+
+/**
+ * Creates a failed result without throwing.
+ *
+ * @param T The value type.
+ * @param E The exception type.
+ * @param ... The initializer of the exception.
+ */
+#define EXCEPT_ERROR(T, E, ...)                                                                    \
+    ((EXCEPT_RESULT(T)){.error = __except_captured_new(__EXCEPT_TYPE(E), (E[1]){__VA_ARGS__})})
+
+/**
+ * Checks whether a result holds a value.
+ *
+ * @param result The result.
+ */
+#define EXCEPT_RESULT_OK(result) ((result).error._private.record == NULL)
+
+/**
+ * Returns the value of a result, or throws its error. The error is thrown as if rethrown by
+ * except_rethrow, which leaves the result empty.
+ *
+ * @param result The result, which must be an lvalue.
+ */
+#define EXCEPT_UNWRAP(result) (except_rethrow(&(result).error), (result).value)
+
+#ifndef EXCEPT_NO_KEYWORDS
+#define try_result __EXCEPT_TRY_RESULT
+#endif
+
+/**
+ * Returns a captured exception without taking it out.
+ *
+ * The exception can be inspected with except_typeof and except_print, but it has no cause.
+ *
+ * @param slot The captured object.
+ * @return The exception, or NULL if the captured object is empty.
+ */
+void* except_captured(const except_captured_t* slot);
+
 /**
  * @}
  */
 
 /**
  * Enables transforming of signals to exceptions.
+ *
+ * Signals are handled on a separate stack of EXCEPT_SIGNAL_STACK_SIZE bytes, which every thread
+ * sets up the first time it enters a try block while this is enabled, unless it already has one.
+ * This lets a stack overflow be thrown as stack_corruption_error_t instead of crashing the
+ * handler. Overflows are recognized by the faulting address being close to the end of the thread
+ * stack, which requires glibc. The per-thread state a throw needs is set up along with the stack,
+ * so the handler itself neither allocates nor takes a lock.
  */
 void except_enable_sigcatch();
 
@@ -201,8 +972,9 @@ typedef struct
 } illegal_instruction_error_t;
 
 /**
- * Thrown whenever the stack is corrupted (for example on stack overflow). This error roughly
- * corresponds to SIGILL. This error is fatal.
+ * Thrown whenever the stack is corrupted or overflows. This error corresponds to SIGILL, or to
+ * SIGSEGV when the faulting address is on the guard pages of the stack. An overflow can be caught,
+ * as long as the handler does not need much more stack than was left; other corruption is fatal.
  */
 typedef struct
 {
@@ -210,6 +982,16 @@ typedef struct
     void* pc;
 } stack_corruption_error_t;
 
+/**
+ * The parent of access_violation_t and misaligned_access_error_t. Catching this catches both kinds
+ * of invalid memory access.
+ */
+typedef struct
+{
+    const char* message;
+    void* address;
+} memory_error_t;
+
 /**
  * Thrown whenever a program tries to access memory which it does not have ownership of. This error
  * corresponds to SIGSEGV and some instances of SIGBUS. This error usually means an invalid or NULL
@@ -233,59 +1015,178 @@ typedef struct
     void* address;
 } misaligned_access_error_t;
 
+/**
+ * Thrown when a try_with_deadline block runs past its deadline.
+ */
+typedef struct
+{
+    const char* message;
+} timeout_error_t;
+
+/**
+ * Thrown by except_malloc and except_realloc when memory is exhausted. The exception itself is
+ * allocated from the emergency reserve if needed, so throwing it does not fail.
+ */
+typedef struct
+{
+    const char* message;
+    size_t size;
+} out_of_memory_error_t;
+
+EXCEPT_DECLARE(arithmetic_error_t);
+EXCEPT_DECLARE(illegal_instruction_error_t);
+EXCEPT_DECLARE(stack_corruption_error_t);
+EXCEPT_DECLARE(memory_error_t);
+EXCEPT_DECLARE(access_violation_t);
+EXCEPT_DECLARE(misaligned_access_error_t);
+EXCEPT_DECLARE(timeout_error_t);
+EXCEPT_DECLARE(out_of_memory_error_t);
+
+/**
+ * Allocates memory like malloc, but throws out_of_memory_error_t on failure.
+ *
+ * @param size The number of bytes to allocate.
+ * @return The memory, which must be released with free.
+ */
+void* except_malloc(size_t size);
+
+/**
+ * Resizes memory like realloc, but throws out_of_memory_error_t on failure.
+ *
+ * @param ptr The memory to resize, or NULL. It is left untouched if an exception is thrown.
+ * @param size The new size in bytes.
+ * @return The resized memory, which must be released with free.
+ */
+void* except_realloc(void* ptr, size_t size);
+
 /*
   End of public API.
  */
 
-#define __EXCEPT_JMP_BUF          jmp_buf
-#define __EXCEPT_SETJMP(buffer)   sigsetjmp(buffer, 1)
-#define __EXCEPT_LONGJMP          siglongjmp
-#define __EXCEPT_STAGE_TRY        0
-#define __EXCEPT_STAGE_CATCH      1
-#define __EXCEPT_STAGE_FINALLY    2
-#define __EXCEPT_STAGE_PROPAGATE  3
-#define __EXCEPT_STAGE_UNEXPECTED -1
-#define __EXCEPT_UNIQUE(var)      __EXCEPT_CONCAT(__except_##var, __LINE__)
-#define __EXCEPT_CONCAT(a, b)     __EXCEPT_CONCAT_(a, b)
-#define __EXCEPT_CONCAT_(a, b)    a##b
-#define __EXCEPT_THROW(T, ...)                                                                     \
-    __except_throw(__EXCEPT_TYPE_NAME(T), sizeof(T), (T[1]){__VA_ARGS__});                         \
-    static_assert(sizeof(T) <= EXCEPT_MAX_THROWABLE_SIZE,                                          \
-                  "Throwable object size exceeds the maximum supported by libexcept")
+#ifdef EXCEPT_WITH_DEFER
+// Each context also records the innermost libdefer frame when the try block was entered. Frames
+// registered after it are unwound before jumping to the context.
+struct __except_context
+{
+    jmp_buf buffer;
+    void* frame;
+};
+
+#define __EXCEPT_JMP_BUF                 struct __except_context
+#define __EXCEPT_SETJMP(context)         sigsetjmp((context).buffer, 1)
+#define __EXCEPT_SETJMP_FAST(context)    sigsetjmp((context).buffer, 0)
+#define __EXCEPT_LONGJMP(context, value) siglongjmp((context).buffer, value)
+#define __EXCEPT_CONTEXT_INIT(context)   ((context).frame = __defer_frame())
+#else
+#define __EXCEPT_JMP_BUF               jmp_buf
+#define __EXCEPT_SETJMP(buffer)        sigsetjmp(buffer, 1)
+#define __EXCEPT_SETJMP_FAST(buffer)   sigsetjmp(buffer, 0)
+#define __EXCEPT_LONGJMP               siglongjmp
+#define __EXCEPT_CONTEXT_INIT(context) ((void)0)
+#endif
+
+#define __EXCEPT_STAGE_TRY           0
+#define __EXCEPT_STAGE_CATCH         1
+#define __EXCEPT_STAGE_FINALLY       2
+#define __EXCEPT_STAGE_PROPAGATE     3
+#define __EXCEPT_STAGE_UNEXPECTED    -1
+#define __EXCEPT_UNIQUE(var)         __EXCEPT_CONCAT(__except_##var, __LINE__)
+#define __EXCEPT_CONCAT(a, b)        __EXCEPT_CONCAT_(a, b)
+#define __EXCEPT_CONCAT_(a, b)       a##b
+#define __EXCEPT_THROW(T, ...) __except_throw(__EXCEPT_TYPE(T), (T[1]){__VA_ARGS__})
 #define __EXCEPT_RETHROW() break
+#define __EXCEPT_DEFINE(T, parent_type, destructor)                                                \
+    except_type_t __except_type_##T = {                                                            \
+        .name = #T,                                                                                \
+        .size = sizeof(T),                                                                         \
+        .destroy = destructor,                                                                     \
+        .parent = parent_type,                                                                     \
+    }
+
+// Scalar types are spelled with several tokens, so they are selected with _Generic. The default
+// association names the descriptor of any other type.
+#define __EXCEPT_TYPE(T)                                                                           \
+    _Generic((T){0}, _Bool                                                                         \
+             : &__except_type_bool, signed char                                                    \
+             : &__except_type_schar, unsigned char                                                 \
+             : &__except_type_uchar, char                                                          \
+             : &__except_type_char, short                                                          \
+             : &__except_type_short, unsigned short                                                \
+             : &__except_type_ushort, int                                                          \
+             : &__except_type_int, unsigned int                                                    \
+             : &__except_type_uint, long                                                           \
+             : &__except_type_long, unsigned long                                                  \
+             : &__except_type_ulong, long long                                                     \
+             : &__except_type_longlong, unsigned long long                                         \
+             : &__except_type_ulonglong, float                                                     \
+             : &__except_type_float, double                                                        \
+             : &__except_type_double, long double                                                  \
+             : &__except_type_ldbl, default                                                        \
+             : &__except_type_##T)
+
+// Single token spellings of scalar types, reached through the default association.
+#define __except_type__Bool    __except_type_bool
+#define __except_type_signed   __except_type_int
+#define __except_type_unsigned __except_type_uint
+
+#ifdef EXCEPT_FAST_TRY
+#define __EXCEPT_TRY __EXCEPT_TRY_FAST
+#else
+#define __EXCEPT_TRY __EXCEPT_TRY_MASKED
+#endif
+
+#define __EXCEPT_TRY_FAST   __EXCEPT_TRY_WITH(__EXCEPT_SETJMP_FAST)
+#define __EXCEPT_TRY_MASKED __EXCEPT_TRY_WITH(__EXCEPT_SETJMP)
+
+#define __EXCEPT_TRY_WITH(save)                                                                    \
+    __EXCEPT_TRY_BLOCK(save(__EXCEPT_UNIQUE(local_buffer)), __except_stage + 1)
+
+// The deadline is computed before setjmp so that it is not modified afterwards. The timer is only
+// armed once setjmp has returned, and disarmed when leaving the try stage.
+#define __EXCEPT_TRY_DEADLINE(ms)                                                                  \
+    const struct __except_deadline __EXCEPT_UNIQUE(deadline) = __except_deadline_enter(ms);        \
+    __EXCEPT_TRY_BLOCK(                                                                            \
+        __except_deadline_start(&__EXCEPT_UNIQUE(deadline),                                        \
+                                __EXCEPT_SETJMP_FAST(__EXCEPT_UNIQUE(local_buffer))),              \
+        __except_deadline_step(&__EXCEPT_UNIQUE(deadline), __except_stage))
+
+// Any throw to the buffer of a try_result is turned into the error of the result.
+#define __EXCEPT_TRY_RESULT(T, expr)                                                               \
+    ({                                                                                             \
+        EXCEPT_RESULT(T) __except_result = {0};                                                    \
+        __EXCEPT_JMP_BUF __except_result_buffer;                                                   \
+        const struct __except_mark __except_result_mark = __except_arena_mark();                   \
+        const struct __except_result_frame __except_result_frame =                                 \
+            __except_result_enter(&__except_result_buffer);                                        \
+        if (__EXCEPT_SETJMP_FAST(__except_result_buffer) == 0)                                     \
+        {                                                                                          \
+            __except_result.value = (expr);                                                        \
+            __except_result_leave(&__except_result_frame, NULL, NULL);                             \
+        }                                                                                          \
+        else                                                                                       \
+        {                                                                                          \
+            __except_result_leave(                                                                 \
+                &__except_result_frame, &__except_result_mark, &__except_result.error);            \
+        }                                                                                          \
+        __except_result;                                                                           \
+    })
 
-#define __EXCEPT_TYPE_NAME(T)                                                                      \
-    _Generic((T){0}, signed char                                                                   \
-             : "schar", unsigned char                                                              \
-             : "uchar", char                                                                       \
-             : "char", short                                                                       \
-             : "short", unsigned short                                                             \
-             : "ushort", int                                                                       \
-             : "int", unsigned int                                                                 \
-             : "uint", long                                                                        \
-             : "long", unsigned long                                                               \
-             : "ulong", long long                                                                  \
-             : "longlong", unsigned long long                                                      \
-             : "ulonglong", float                                                                  \
-             : "float", double                                                                     \
-             : "double", long double                                                               \
-             : "ldbl", default                                                                     \
-             : #T)
-
-#define __EXCEPT_TRY                                                                               \
+#define __EXCEPT_TRY_BLOCK(start, step)                                                            \
     __EXCEPT_JMP_BUF __EXCEPT_UNIQUE(local_buffer);                                                \
     __EXCEPT_JMP_BUF* __EXCEPT_UNIQUE(old_buffer) = *__except_current_context();                   \
+    const struct __except_mark __EXCEPT_UNIQUE(mark) = __except_arena_mark();                      \
     *__except_current_context() = &__EXCEPT_UNIQUE(local_buffer);                                  \
-    for (int __except_stage = 0, __except_error = __EXCEPT_SETJMP(__EXCEPT_UNIQUE(local_buffer));  \
-         __except_stage < 4;                                                                       \
-         __except_stage++)                                                                         \
+    __EXCEPT_CONTEXT_INIT(__EXCEPT_UNIQUE(local_buffer));                                          \
+    for (int __except_stage = 0, __except_error = start; __except_stage < 4;                       \
+         __except_stage = step)                                                                    \
         if (__except_stage == __EXCEPT_STAGE_PROPAGATE)                                            \
         {                                                                                          \
             *__except_current_context() = __EXCEPT_UNIQUE(old_buffer);                             \
             if (__except_error != 0)                                                               \
             {                                                                                      \
-                __except_throw(NULL, 0, NULL);                                                     \
+                __except_throw(NULL, NULL);                                                        \
             }                                                                                      \
+            __except_arena_release(&__EXCEPT_UNIQUE(mark));                                        \
         }                                                                                          \
         else if (__except_stage == __EXCEPT_STAGE_UNEXPECTED)                                      \
         {                                                                                          \
@@ -295,17 +1196,40 @@ typedef struct
 
 #define __EXCEPT_CATCH(T, var)                                                                     \
     else if (__except_stage == __EXCEPT_STAGE_CATCH && __except_error != 0 &&                      \
-             __except_personality(__EXCEPT_TYPE_NAME(T)))                                          \
+             __except_match(__EXCEPT_TYPE(T)))                                                     \
         __EXCEPT_UNEXPECTED_LOOP(__EXCEPT_STAGE_CATCH) for (T var =                                \
                                                                 *(T*)__except_current_exception(); \
                                                             __except_error != 0;                   \
                                                             __except_error = 0)
 
 #define __EXCEPT_CATCH_ANY                                                                         \
-    else if (__except_stage == __EXCEPT_STAGE_CATCH && __except_error != 0)                        \
+    else if (__except_stage == __EXCEPT_STAGE_CATCH && __except_error != 0 &&                      \
+             __except_personality(NULL))                                                           \
         __EXCEPT_UNEXPECTED_LOOP(__EXCEPT_STAGE_CATCH) for (; __except_error != 0;                 \
                                                             __except_error = 0)
 
+#define __EXCEPT_CATCH_ONE_OF(var, ...)                                                            \
+    else if (__except_stage == __EXCEPT_STAGE_CATCH && __except_error != 0 &&                      \
+             __except_match_one_of((except_type_t*[]){__EXCEPT_TYPES(__VA_ARGS__)},                \
+                                   __EXCEPT_COUNT(__VA_ARGS__)))                                   \
+        __EXCEPT_UNEXPECTED_LOOP(__EXCEPT_STAGE_CATCH) for (void* var =                            \
+                                                                __except_current_exception();      \
+                                                            __except_error != 0;                   \
+                                                            __except_error = 0)
+
+#define __EXCEPT_COUNT(...) __EXCEPT_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1)
+#define __EXCEPT_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define __EXCEPT_TYPES(...)                                                                        \
+    __EXCEPT_CONCAT(__EXCEPT_TYPES_, __EXCEPT_COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define __EXCEPT_TYPES_1(T)      __EXCEPT_TYPE(T)
+#define __EXCEPT_TYPES_2(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_1(__VA_ARGS__)
+#define __EXCEPT_TYPES_3(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_2(__VA_ARGS__)
+#define __EXCEPT_TYPES_4(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_3(__VA_ARGS__)
+#define __EXCEPT_TYPES_5(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_4(__VA_ARGS__)
+#define __EXCEPT_TYPES_6(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_5(__VA_ARGS__)
+#define __EXCEPT_TYPES_7(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_6(__VA_ARGS__)
+#define __EXCEPT_TYPES_8(T, ...) __EXCEPT_TYPE(T), __EXCEPT_TYPES_7(__VA_ARGS__)
+
 #define __EXCEPT_FINALLY                                                                           \
     else if (__except_stage == __EXCEPT_STAGE_FINALLY)                                             \
         __EXCEPT_UNEXPECTED_LOOP(__EXCEPT_STAGE_FINALLY)
@@ -319,10 +1243,100 @@ typedef struct
  */
 
 __EXCEPT_JMP_BUF** __except_current_context();
-noreturn void __except_throw(const char*, size_t, void*);
+struct __except_mark
+{
+    struct __except_chunk* chunk;
+    size_t used;
+    struct __except_record* current;
+};
+
+struct __except_result_frame
+{
+    __EXCEPT_JMP_BUF* context;
+    __EXCEPT_JMP_BUF* result;
+};
+
+struct __except_deadline
+{
+    struct timespec previous;
+    struct timespec deadline;
+    struct __except_record* previous_current;
+    size_t depth;
+};
+
+noreturn void __except_throw(except_type_t*, void*);
 noreturn void __except_unexpected();
 noreturn void __except_unhandled();
-int __except_personality(const char*);
+struct __except_mark __except_arena_mark();
+void __except_arena_release(const struct __except_mark*);
+void* __except_new(except_type_t*, size_t);
+int __except_personality(except_type_t*);
+int __except_instance_of(except_type_t*);
 void* __except_current_exception();
+struct __except_deadline __except_deadline_enter(long);
+int __except_deadline_start(const struct __except_deadline*, int);
+int __except_deadline_step(const struct __except_deadline*, int);
+struct __except_result_frame __except_result_enter(__EXCEPT_JMP_BUF*);
+void __except_result_leave(const struct __except_result_frame*, const struct __except_mark*,
+                           except_captured_t*);
+except_captured_t __except_captured_new(except_type_t*, const void*);
+
+extern except_type_t __except_type_bool;
+extern except_type_t __except_type_schar;
+extern except_type_t __except_type_uchar;
+extern except_type_t __except_type_char;
+extern except_type_t __except_type_short;
+extern except_type_t __except_type_ushort;
+extern except_type_t __except_type_int;
+extern except_type_t __except_type_uint;
+extern except_type_t __except_type_long;
+extern except_type_t __except_type_ulong;
+extern except_type_t __except_type_longlong;
+extern except_type_t __except_type_ulonglong;
+extern except_type_t __except_type_float;
+extern except_type_t __except_type_double;
+extern except_type_t __except_type_ldbl;
+
+// The type of the exception being handled, if any.
+extern thread_local except_type_t* __except_thrown;
+
+// Catch clauses must not cost a libdefer frame in code built with -finstrument-functions.
+#define __EXCEPT_INLINE static inline __attribute__((no_instrument_function))
+
+// Whether the exception being handled is of the given type or derived from it.
+__EXCEPT_INLINE int __except_is(except_type_t* type)
+{
+    const except_type_t* thrown = __except_thrown;
+    if (thrown == type)
+    {
+        return 1;
+    }
+
+    if (!atomic_load_explicit(&type->_private.resolved, memory_order_acquire))
+    {
+        return __except_instance_of(type);
+    }
+
+    const size_t depth = type->_private.depth;
+    return thrown->_private.depth > depth && thrown->_private.ancestors[depth] == type;
+}
+
+__EXCEPT_INLINE int __except_match(except_type_t* type)
+{
+    return __except_is(type) && __except_personality(NULL);
+}
+
+__EXCEPT_INLINE int __except_match_one_of(except_type_t* const* types, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (__except_is(types[i]))
+        {
+            return __except_personality(NULL);
+        }
+    }
+
+    return 0;
+}
 
 #endif // EXCEPT_H
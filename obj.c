@@ -24,12 +24,500 @@
 
 #include "obj.h"
 
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 void (*obj_on_missing_method)(const obj_t* object, const char* name);
 
+static once_flag __obj_once_flag = ONCE_FLAG_INIT;
+static mtx_t __obj_lock;
+static mtx_t __obj_synchronize_lock;
+
+static void __obj_one_time_init()
+{
+    if (mtx_init(&__obj_lock, mtx_plain) != thrd_success ||
+        mtx_init(&__obj_synchronize_lock, mtx_plain) != thrd_success)
+    {
+        fputs("Could not initialize libobj lock\n", stderr);
+        abort();
+    }
+}
+
+// Relocatable objects store (id << 1) | 1 in their header, which can never be a vtable address.
+static _Atomic(const struct __obj_vtable*) __obj_types[OBJ_TYPES_MAX];
+static size_t __obj_type_count;
+
+const struct __obj_vtable* __obj_vtable_of(const obj_t* self)
+{
+    const uintptr_t header = (uintptr_t)*self;
+    if ((header & 1) == 0)
+    {
+        return *self;
+    }
+
+    const size_t id = header >> 1;
+    const struct __obj_vtable* vtable =
+        id < OBJ_TYPES_MAX ? atomic_load_explicit(&__obj_types[id], memory_order_acquire) : NULL;
+    if (vtable == NULL)
+    {
+        fprintf(stderr, "Relocatable object %p has unregistered type id %zu\n", self, id);
+        abort();
+    }
+
+    return vtable;
+}
+
+#define OBJ_READER_SHARDS 16
+
+// Lookups of patched types are tracked SRCU style: a reader increments a counter of the current
+// epoch parity, and a writer flips the parity twice, waiting for the counters of the previous one
+// to drain each time. Counters are sharded by thread to keep readers from sharing a cache line.
+// Threads are assigned shards round robin on their first read, since addresses of thread locals
+// are too regularly spaced to hash.
+struct __obj_reader_shard
+{
+    atomic_long count;
+    char padding[64 - sizeof(atomic_long)];
+};
+
+static atomic_uint __obj_reader_epoch;
+static struct __obj_reader_shard __obj_readers[2][OBJ_READER_SHARDS];
+static atomic_size_t __obj_reader_next_shard;
+static thread_local size_t __obj_reader_shard = OBJ_READER_SHARDS;
+static thread_local size_t __obj_reader_depth;
+
+// Enters a read section, returning what must be passed to __obj_reader_exit. Pointers protected by
+// it must be loaded after entering.
+static atomic_long* __obj_reader_enter()
+{
+    if (__obj_reader_shard == OBJ_READER_SHARDS)
+    {
+        __obj_reader_shard =
+            atomic_fetch_add_explicit(&__obj_reader_next_shard, 1, memory_order_relaxed) %
+            OBJ_READER_SHARDS;
+    }
+
+    const unsigned parity = atomic_load(&__obj_reader_epoch) & 1;
+    atomic_long* counter = &__obj_readers[parity][__obj_reader_shard].count;
+    atomic_fetch_add(counter, 1);
+    __obj_reader_depth++;
+    return counter;
+}
+
+static void __obj_reader_exit(atomic_long* counter)
+{
+    __obj_reader_depth--;
+    atomic_fetch_sub_explicit(counter, 1, memory_order_release);
+}
+
+// Returns the vtable to look methods up in. counter is set to what must be passed to
+// __obj_read_end once the lookup is done.
+static const struct __obj_vtable* __obj_read_begin(const struct __obj_vtable* vtable,
+                                                   atomic_long** counter)
+{
+    *counter = NULL;
+    if (atomic_load_explicit(&vtable->_private.patched, memory_order_relaxed) == NULL)
+    {
+        return vtable;
+    }
+
+    *counter = __obj_reader_enter();
+    const struct __obj_vtable* patched = atomic_load(&vtable->_private.patched);
+    return patched == NULL ? vtable : patched;
+}
+
+static void __obj_read_end(atomic_long* counter)
+{
+    if (counter != NULL)
+    {
+        __obj_reader_exit(counter);
+    }
+}
+
+// Waits for all read sections that started before the call. Must be called with
+// __obj_synchronize_lock held, and never with __obj_lock held, so that a slow reader does not stall
+// unrelated writers.
+static void __obj_synchronize()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        const unsigned parity = atomic_fetch_add(&__obj_reader_epoch, 1) & 1;
+        for (size_t shard = 0; shard < OBJ_READER_SHARDS; shard++)
+        {
+            while (atomic_load(&__obj_readers[parity][shard].count) != 0)
+            {
+                thrd_yield();
+            }
+        }
+    }
+}
+
+struct __obj_retired
+{
+    struct __obj_retired* next;
+    void* memory;
+};
+
+// Memory retired from within read sections, which is freed by the next grace period.
+static _Atomic(struct __obj_retired*) __obj_retired;
+
+// Frees memory that has been unpublished once no read section can be using it anymore. Must not be
+// called with __obj_lock held.
+static void __obj_retire(void* memory)
+{
+    if (memory == NULL)
+    {
+        return;
+    }
+
+    if (__obj_reader_depth != 0)
+    {
+        // Waiting for readers would wait for this thread as well, so leave it to a later call. If
+        // even that is impossible the memory is leaked.
+        struct __obj_retired* retired = malloc(sizeof(struct __obj_retired));
+        if (retired != NULL)
+        {
+            retired->memory = memory;
+            retired->next = atomic_load_explicit(&__obj_retired, memory_order_relaxed);
+            while (!atomic_compare_exchange_weak_explicit(&__obj_retired,
+                                                          &retired->next,
+                                                          retired,
+                                                          memory_order_release,
+                                                          memory_order_relaxed))
+            {
+            }
+        }
+        return;
+    }
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    struct __obj_retired* retired = atomic_exchange(&__obj_retired, NULL);
+
+    mtx_lock(&__obj_synchronize_lock);
+    __obj_synchronize();
+    mtx_unlock(&__obj_synchronize_lock);
+
+    free(memory);
+    while (retired != NULL)
+    {
+        struct __obj_retired* next = retired->next;
+        free(retired->memory);
+        free(retired);
+        retired = next;
+    }
+}
+
+// Merges the parent's methods and fields into a derived vtable. Runs once per type.
+static void __obj_vtable_merge(struct __obj_vtable* self, const struct __obj_vtable* parent)
+{
+    if (parent->_private.depth + 1 >= OBJ_DEPTH_MAX)
+    {
+        fprintf(stderr, "Type hierarchy of %s exceeds OBJ_DEPTH_MAX\n", self->_private.name);
+        abort();
+    }
+
+    self->_private.depth = parent->_private.depth + 1;
+    memcpy(self->_private.ancestors,
+           parent->_private.ancestors,
+           self->_private.depth * sizeof(self->_private.ancestors[0]));
+    self->_private.ancestors[self->_private.depth] = self;
+
+    size_t count = 0;
+    while (count < OBJ_METHODS_MAX && self->_private.methods[count].name != NULL)
+    {
+        count++;
+    }
+
+    // Overrides come first, so inherited methods are only added if not already present.
+    for (size_t i = 0; i < OBJ_METHODS_MAX && parent->_private.methods[i].name != NULL; i++)
+    {
+        bool overridden = false;
+        for (size_t j = 0; j < count && !overridden; j++)
+        {
+            overridden =
+                strcmp(self->_private.methods[j].name, parent->_private.methods[i].name) == 0;
+        }
+
+        if (overridden)
+        {
+            continue;
+        }
+
+        if (count == OBJ_METHODS_MAX)
+        {
+            fprintf(stderr, "Type %s has more than OBJ_METHODS_MAX methods\n", self->_private.name);
+            abort();
+        }
+
+        self->_private.methods[count].name = parent->_private.methods[i].name;
+        self->_private.methods[count].impl = parent->_private.methods[i].impl;
+        count++;
+    }
+
+    if (parent->_private.field_count == 0)
+    {
+        return;
+    }
+
+    if (self->_private.field_count == 0)
+    {
+        self->_private.fields = parent->_private.fields;
+        self->_private.field_count = parent->_private.field_count;
+        return;
+    }
+
+    // The merged field list lives as long as the type, so it is never freed.
+    const size_t field_count = parent->_private.field_count + self->_private.field_count;
+    struct __obj_field* fields = malloc(field_count * sizeof(struct __obj_field));
+    if (fields == NULL)
+    {
+        fputs("Could not allocate field list\n", stderr);
+        abort();
+    }
+
+    memcpy(fields, parent->_private.fields, parent->_private.field_count * sizeof(*fields));
+    memcpy(fields + parent->_private.field_count,
+           self->_private.fields,
+           self->_private.field_count * sizeof(*fields));
+
+    self->_private.fields = fields;
+    self->_private.field_count = field_count;
+}
+
+#define OBJ_INTERFACE_CACHE_DEFAULT_CAP 64
+
+struct __obj_interface_entry
+{
+    _Atomic(const struct __obj_vtable*) vtable;
+    const obj_interface_t* interface;
+    const void* table;
+};
+
+// Open addressing table, readers never lock. Entries are immutable once their vtable is published
+// and a full table is replaced by a larger copy. Readers look up within a read section, so replaced
+// tables are retired rather than freed right away.
+struct __obj_interface_cache
+{
+    size_t count;
+    size_t cap;
+    struct __obj_interface_entry entries[];
+};
+
+static _Atomic(struct __obj_interface_cache*) __obj_interface_cache;
+
+static size_t __obj_interface_slot(const struct __obj_vtable* vtable,
+                                   const obj_interface_t* interface,
+                                   size_t cap)
+{
+    uint64_t hash = (uint64_t)(uintptr_t)vtable * 0x9e3779b97f4a7c15ull;
+    hash ^= (uint64_t)(uintptr_t)interface * 0xc2b2ae3d27d4eb4full;
+    return (size_t)(hash ^ (hash >> 29)) & (cap - 1);
+}
+
+static const struct __obj_interface_entry* __obj_interface_lookup(
+    const struct __obj_interface_cache* cache,
+    const struct __obj_vtable* vtable,
+    const obj_interface_t* interface)
+{
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t slot = __obj_interface_slot(vtable, interface, cache->cap);;
+         slot = (slot + 1) & (cache->cap - 1))
+    {
+        const struct __obj_interface_entry* entry = &cache->entries[slot];
+        const struct __obj_vtable* key = atomic_load_explicit(&entry->vtable, memory_order_acquire);
+
+        if (key == NULL)
+        {
+            return NULL;
+        }
+
+        if (key == vtable && entry->interface == interface)
+        {
+            return entry;
+        }
+    }
+}
+
+static void __obj_interface_insert(struct __obj_interface_cache* cache,
+                                   const struct __obj_vtable* vtable,
+                                   const obj_interface_t* interface,
+                                   const void* table)
+{
+    size_t slot = __obj_interface_slot(vtable, interface, cache->cap);
+    while (atomic_load_explicit(&cache->entries[slot].vtable, memory_order_relaxed) != NULL)
+    {
+        slot = (slot + 1) & (cache->cap - 1);
+    }
+
+    cache->entries[slot].interface = interface;
+    cache->entries[slot].table = table;
+    atomic_store_explicit(&cache->entries[slot].vtable, vtable, memory_order_release);
+    cache->count++;
+}
+
+// Drops the entries of a type whose methods changed. Must be called with the lock held. Returns the
+// replaced cache, which must be retired once the lock is released.
+static struct __obj_interface_cache* __obj_interface_invalidate(const struct __obj_vtable* vtable)
+{
+    struct __obj_interface_cache* cache =
+        atomic_load_explicit(&__obj_interface_cache, memory_order_relaxed);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    struct __obj_interface_cache* new_cache =
+        calloc(1, sizeof(*new_cache) + cache->cap * sizeof(struct __obj_interface_entry));
+    if (new_cache == NULL)
+    {
+        fputs("Could not allocate interface cache\n", stderr);
+        abort();
+    }
+
+    new_cache->cap = cache->cap;
+
+    for (size_t i = 0; i < cache->cap; i++)
+    {
+        const struct __obj_vtable* key =
+            atomic_load_explicit(&cache->entries[i].vtable, memory_order_relaxed);
+        if (key != NULL && key != vtable)
+        {
+            __obj_interface_insert(
+                new_cache, key, cache->entries[i].interface, cache->entries[i].table);
+        }
+    }
+
+    atomic_store_explicit(&__obj_interface_cache, new_cache, memory_order_release);
+    return cache;
+}
+
+// Returns NULL if a method is missing.
+static const void* __obj_interface_resolve(const obj_t* self, const obj_interface_t* interface)
+{
+    char* table = malloc(interface->_private.size);
+    if (table == NULL)
+    {
+        fputs("Could not allocate interface table\n", stderr);
+        abort();
+    }
+
+    for (size_t i = 0; i < interface->_private.count; i++)
+    {
+        void (*method)(void) = obj_find_method(self, interface->_private.methods[i].name);
+        if (method == NULL)
+        {
+            free(table);
+            return NULL;
+        }
+
+        memcpy(table + interface->_private.methods[i].offset, &method, sizeof(method));
+    }
+
+    return table;
+}
+
+const void* obj_query_interface(const obj_t* self, const obj_interface_t* interface)
+{
+    const struct __obj_vtable* vtable = __obj_vtable_of(self);
+
+    // Resolved tables are never freed, so they can be returned after leaving the read section.
+    atomic_long* counter = __obj_reader_enter();
+    const struct __obj_interface_entry* entry = __obj_interface_lookup(
+        atomic_load_explicit(&__obj_interface_cache, memory_order_acquire), vtable, interface);
+    const void* table = entry == NULL ? NULL : entry->table;
+    __obj_reader_exit(counter);
+    if (entry != NULL)
+    {
+        return table;
+    }
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    mtx_lock(&__obj_lock);
+
+    struct __obj_interface_cache* cache =
+        atomic_load_explicit(&__obj_interface_cache, memory_order_relaxed);
+
+    // Someone else may have resolved it in the meantime.
+    entry = __obj_interface_lookup(cache, vtable, interface);
+    if (entry != NULL)
+    {
+        mtx_unlock(&__obj_lock);
+        return entry->table;
+    }
+
+    struct __obj_interface_cache* replaced = NULL;
+    if (cache == NULL || (cache->count + 1) * 2 > cache->cap)
+    {
+        const size_t new_cap = cache == NULL ? OBJ_INTERFACE_CACHE_DEFAULT_CAP : cache->cap * 2;
+        struct __obj_interface_cache* new_cache =
+            calloc(1, sizeof(*new_cache) + new_cap * sizeof(struct __obj_interface_entry));
+        if (new_cache == NULL)
+        {
+            fputs("Could not allocate interface cache\n", stderr);
+            abort();
+        }
+
+        new_cache->cap = new_cap;
+
+        for (size_t i = 0; cache != NULL && i < cache->cap; i++)
+        {
+            const struct __obj_vtable* vtable =
+                atomic_load_explicit(&cache->entries[i].vtable, memory_order_relaxed);
+            if (vtable != NULL)
+            {
+                __obj_interface_insert(
+                    new_cache, vtable, cache->entries[i].interface, cache->entries[i].table);
+            }
+        }
+
+        replaced = cache;
+        cache = new_cache;
+    }
+
+    table = __obj_interface_resolve(self, interface);
+    __obj_interface_insert(cache, vtable, interface, table);
+    atomic_store_explicit(&__obj_interface_cache, cache, memory_order_release);
+
+    mtx_unlock(&__obj_lock);
+
+    __obj_retire(replaced);
+    return table;
+}
+
+const struct __obj_vtable* __obj_vtable_derive(struct __obj_vtable* self,
+                                               const struct __obj_vtable* parent)
+{
+    if (atomic_load_explicit(&self->_private.derived, memory_order_acquire))
+    {
+        return self;
+    }
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    mtx_lock(&__obj_lock);
+
+    if (!atomic_load_explicit(&self->_private.derived, memory_order_relaxed))
+    {
+        // Patches are published under the lock, so the parent's current methods can be read
+        // directly.
+        const struct __obj_vtable* patched =
+            atomic_load_explicit(&parent->_private.patched, memory_order_relaxed);
+        __obj_vtable_merge(self, patched == NULL ? parent : patched);
+        atomic_store_explicit(&self->_private.derived, true, memory_order_release);
+    }
+
+    mtx_unlock(&__obj_lock);
+    return self;
+}
+
 void (*__obj_get_method(const obj_t* self, const char* name))(void)
 {
     void (*method)(void) = obj_find_method(self, name);
@@ -57,95 +545,1237 @@ void (*__obj_get_method(const obj_t* self, const char* name))(void)
 
 void (*obj_find_method(const obj_t* self, const char* name))(void)
 {
+    atomic_long* counter;
+    const struct __obj_vtable* vtable = __obj_read_begin(__obj_vtable_of(self), &counter);
+    void (*method)(void) = NULL;
+
     for (size_t i = 0; i < OBJ_METHODS_MAX; i++)
     {
-        if ((*self)->_private.methods[i].name == NULL)
+        if (vtable->_private.methods[i].name == NULL)
         {
             break;
         }
 
-        if (strcmp((*self)->_private.methods[i].name, name) == 0)
+        if (strcmp(vtable->_private.methods[i].name, name) == 0)
         {
-            return (*self)->_private.methods[i].impl;
+            method = vtable->_private.methods[i].impl;
+            break;
         }
     }
 
-    return NULL;
+    __obj_read_end(counter);
+    return method;
+}
+
+obj_vtable_t* obj_vtable_clone(const obj_t* self)
+{
+    struct __obj_vtable* vtable = malloc(sizeof(struct __obj_vtable));
+    if (vtable == NULL)
+    {
+        return NULL;
+    }
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    mtx_lock(&__obj_lock);
+
+    const struct __obj_vtable* type = __obj_vtable_of(self);
+    const struct __obj_vtable* patched =
+        atomic_load_explicit(&type->_private.patched, memory_order_relaxed);
+    memcpy(vtable, patched == NULL ? type : patched, sizeof(struct __obj_vtable));
+    atomic_init(&vtable->_private.patched, NULL);
+
+    mtx_unlock(&__obj_lock);
+    return vtable;
+}
+
+int obj_vtable_set(obj_vtable_t* vtable, const char* name, void (*impl)(void))
+{
+    size_t i = 0;
+    while (i < OBJ_METHODS_MAX && vtable->_private.methods[i].name != NULL &&
+           strcmp(vtable->_private.methods[i].name, name) != 0)
+    {
+        i++;
+    }
+
+    if (i == OBJ_METHODS_MAX)
+    {
+        return ENOSPC;
+    }
+
+    vtable->_private.methods[i].name = name;
+    vtable->_private.methods[i].impl = impl;
+    return 0;
+}
+
+int obj_vtable_publish(const obj_t* self, obj_vtable_t* vtable)
+{
+    // A type's own vtable is always the last of its ancestors, and clones keep that.
+    struct __obj_vtable* type = (struct __obj_vtable*)__obj_vtable_of(self);
+    if (vtable != NULL && vtable->_private.ancestors[vtable->_private.depth] != type)
+    {
+        return EINVAL;
+    }
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    mtx_lock(&__obj_lock);
+
+    const struct __obj_vtable* previous = atomic_exchange(&type->_private.patched, vtable);
+    struct __obj_interface_cache* replaced = __obj_interface_invalidate(type);
+
+    mtx_unlock(&__obj_lock);
+
+    __obj_retire(replaced);
+    if (previous != vtable)
+    {
+        __obj_retire((void*)previous);
+    }
+
+    return 0;
+}
+
+void obj_vtable_discard(obj_vtable_t* vtable)
+{
+    free(vtable);
 }
 
 const char* obj_typeof(const obj_t* self)
 {
-    return (*self)->_private.name;
+    return __obj_vtable_of(self)->_private.name;
 }
 
 size_t obj_sizeof(const obj_t* self)
 {
-    return (*self)->_private.size;
+    return __obj_vtable_of(self)->_private.size;
 }
 
 uintptr_t obj_typeid(const obj_t* self)
 {
-    return (uintptr_t)*self;
+    return (uintptr_t)__obj_vtable_of(self);
 }
 
-void obj_print_vtable(const obj_t* self)
+bool obj_is_a(const obj_t* self, uintptr_t type)
 {
-    fprintf(stderr, "VTable for type %s:\n", obj_typeof(self));
+    const struct __obj_vtable* target = (const struct __obj_vtable*)type;
+    const size_t depth = target->_private.depth;
 
-    for (size_t i = 0; i < OBJ_METHODS_MAX; i++)
+    const struct __obj_vtable* vtable = __obj_vtable_of(self);
+    return vtable->_private.depth >= depth && vtable->_private.ancestors[depth] == target;
+}
+
+int obj_type_register(const obj_t* prototype, size_t* id)
+{
+    struct __obj_vtable* vtable = (struct __obj_vtable*)__obj_vtable_of(prototype);
+
+    call_once(&__obj_once_flag, __obj_one_time_init);
+    mtx_lock(&__obj_lock);
+
+    // Ids are stored off by one so that 0 means unregistered.
+    size_t type_id = atomic_load_explicit(&vtable->_private.type_id, memory_order_relaxed);
+    if (type_id == 0)
     {
-        if ((*self)->_private.methods[i].name != NULL)
+        if (__obj_type_count == OBJ_TYPES_MAX)
         {
-            fprintf(stderr,
-                    "  %s::%s() - %p\n",
-                    obj_typeof(self),
-                    (*self)->_private.methods[i].name,
-                    (*self)->_private.methods[i].impl);
+            mtx_unlock(&__obj_lock);
+            return ENOSPC;
         }
+
+        type_id = ++__obj_type_count;
+        atomic_store_explicit(&__obj_types[type_id - 1], vtable, memory_order_release);
+        atomic_store_explicit(&vtable->_private.type_id, type_id, memory_order_release);
     }
-}
 
-void obj_destroy(obj_t* self)
-{
-    void (*method)(void) = obj_find_method(self, __func__);
-    if (method == NULL)
+    mtx_unlock(&__obj_lock);
+
+    if (id != NULL)
     {
-        return;
+        *id = type_id - 1;
     }
 
-    ((void (*)(obj_t*))method)(self);
+    return 0;
 }
 
-char* obj_to_string(const obj_t* self)
+int obj_make_relocatable(obj_t* self)
 {
-    void (*method)(void) = obj_find_method(self, __func__);
-    if (method == NULL)
+    const size_t type_id =
+        atomic_load_explicit(&__obj_vtable_of(self)->_private.type_id, memory_order_acquire);
+    if (type_id == 0)
     {
-        const char* type = obj_typeof(self);
-
-        // return strdup(type)
-        const size_t size = strlen(type) + 1;
-        return memcpy(malloc(size), type, size);
+        return ENOENT;
     }
 
-    return ((char* (*)(const obj_t*))method)(self);
+    *self = (const struct __obj_vtable*)(((type_id - 1) << 1) | 1);
+    return 0;
 }
 
-int obj_cmp(const obj_t* self, const obj_t* other)
+void obj_print_vtable(const obj_t* self)
 {
-    const size_t self_size = obj_sizeof(self);
-    const size_t other_size = obj_sizeof(other);
+    fprintf(stderr, "VTable for type %s:\n", obj_typeof(self));
 
-    if (self_size != other_size)
-    {
-        return self_size - other_size;
+    atomic_long* counter;
+    const struct __obj_vtable* vtable = __obj_read_begin(__obj_vtable_of(self), &counter);
+
+    for (size_t i = 0; i < OBJ_METHODS_MAX; i++)
+    {
+        if (vtable->_private.methods[i].name != NULL)
+        {
+            fprintf(stderr,
+                    "  %s::%s() - %p\n",
+                    obj_typeof(self),
+                    vtable->_private.methods[i].name,
+                    vtable->_private.methods[i].impl);
+        }
     }
 
+    for (size_t i = 0; i < vtable->_private.field_count; i++)
+    {
+        fprintf(stderr,
+                "  %s::%s - offset %zu, size %zu\n",
+                obj_typeof(self),
+                vtable->_private.fields[i].name,
+                vtable->_private.fields[i].offset,
+                vtable->_private.fields[i].size);
+    }
+
+    __obj_read_end(counter);
+}
+
+void obj_destroy(obj_t* self)
+{
     void (*method)(void) = obj_find_method(self, __func__);
     if (method == NULL)
     {
-        return memcmp(self, other, self_size);
+        return;
+    }
+
+    ((void (*)(obj_t*))method)(self);
+}
+
+char* obj_to_string(const obj_t* self)
+{
+    void (*method)(void) = obj_find_method(self, __func__);
+    if (method != NULL)
+    {
+        return ((char* (*)(const obj_t*))method)(self);
+    }
+
+    obj_writer_t writer;
+    if (obj_writer_create(&writer, 0) != 0)
+    {
+        return NULL;
+    }
+
+    if (obj_write(self, &writer) != 0)
+    {
+        obj_writer_destroy(&writer);
+        return NULL;
+    }
+
+    // Ownership of the buffer passes to the caller.
+    return writer._private.data;
+}
+
+int obj_write(const obj_t* self, obj_writer_t* writer)
+{
+    void (*method)(void) = obj_find_method(self, __func__);
+    if (method != NULL)
+    {
+        return ((int (*)(const obj_t*, obj_writer_t*))method)(self, writer);
+    }
+
+    method = obj_find_method(self, "obj_to_string");
+    if (method != NULL)
+    {
+        char* string = ((char* (*)(const obj_t*))method)(self);
+        if (string == NULL)
+        {
+            return ENOMEM;
+        }
+
+        const int result = obj_writer_puts(writer, string);
+        free(string);
+        return result;
+    }
+
+    return obj_writer_puts(writer, obj_typeof(self));
+}
+
+size_t obj_format(const obj_t* self, char* buffer, size_t capacity)
+{
+    obj_writer_t writer = {
+        ._private.data = buffer,
+        ._private.cap = capacity,
+        ._private.growable = false,
+    };
+
+    if (capacity != 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    obj_write(self, &writer);
+    return writer._private.size;
+}
+
+int obj_writer_create(obj_writer_t* self, size_t capacity)
+{
+    capacity = capacity == 0 ? OBJ_WRITER_DEFAULT_CAP : capacity;
+
+    self->_private.data = malloc(capacity);
+    if (self->_private.data == NULL)
+    {
+        return ENOMEM;
+    }
+
+    self->_private.data[0] = '\0';
+    self->_private.size = 0;
+    self->_private.cap = capacity;
+    self->_private.growable = true;
+
+    return 0;
+}
+
+void obj_writer_destroy(obj_writer_t* self)
+{
+    free(self->_private.data);
+    self->_private.data = NULL;
+    self->_private.size = 0;
+    self->_private.cap = 0;
+}
+
+void obj_writer_clear(obj_writer_t* self)
+{
+    self->_private.size = 0;
+
+    if (self->_private.cap != 0)
+    {
+        self->_private.data[0] = '\0';
+    }
+}
+
+const char* obj_writer_data(const obj_writer_t* self)
+{
+    return self->_private.cap == 0 ? "" : self->_private.data;
+}
+
+size_t obj_writer_size(const obj_writer_t* self)
+{
+    return self->_private.size;
+}
+
+// Makes room for count more characters plus the NUL terminator. Fixed writers always succeed and
+// truncate instead.
+static int __obj_writer_reserve(obj_writer_t* self, size_t count)
+{
+    const size_t desired = self->_private.size + count + 1;
+    if (!self->_private.growable || desired <= self->_private.cap)
+    {
+        return 0;
+    }
+
+    size_t new_cap = self->_private.cap == 0 ? OBJ_WRITER_DEFAULT_CAP : self->_private.cap;
+    while (new_cap < desired)
+    {
+        new_cap *= 2;
+    }
+
+    char* new_data = realloc(self->_private.data, new_cap);
+    if (new_data == NULL)
+    {
+        return ENOMEM;
+    }
+
+    self->_private.data = new_data;
+    self->_private.cap = new_cap;
+
+    return 0;
+}
+
+int obj_writer_write(obj_writer_t* self, const char* data, size_t size)
+{
+    const int result = __obj_writer_reserve(self, size);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    if (self->_private.size < self->_private.cap)
+    {
+        const size_t available = self->_private.cap - self->_private.size - 1;
+        const size_t count = size < available ? size : available;
+
+        memcpy(self->_private.data + self->_private.size, data, count);
+        self->_private.data[self->_private.size + count] = '\0';
+    }
+
+    self->_private.size += size;
+    return 0;
+}
+
+int obj_writer_puts(obj_writer_t* self, const char* string)
+{
+    return obj_writer_write(self, string, strlen(string));
+}
+
+int obj_writer_printf(obj_writer_t* self, const char* format, ...)
+{
+    const size_t available =
+        self->_private.size < self->_private.cap ? self->_private.cap - self->_private.size : 0;
+
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(
+        available == 0 ? NULL : self->_private.data + self->_private.size, available, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return EINVAL;
+    }
+
+    // Did not fit, grow and try again.
+    if ((size_t)length >= available && self->_private.growable)
+    {
+        const int result = __obj_writer_reserve(self, length);
+        if (result != 0)
+        {
+            return result;
+        }
+
+        va_start(args, format);
+        vsnprintf(self->_private.data + self->_private.size, length + 1, format, args);
+        va_end(args);
+    }
+
+    self->_private.size += length;
+    return 0;
+}
+
+struct __obj_arena_chunk
+{
+    struct __obj_arena_chunk* next;
+    char* end;
+    max_align_t data[];
+};
+
+struct __obj_arena_type
+{
+    const struct __obj_vtable* vtable;
+    void (*destroy)(obj_t*);
+    bool resolved;
+    size_t count;
+    size_t offset;
+};
+
+void obj_arena_create(obj_arena_t* self)
+{
+    memset(self, 0, sizeof(*self));
+}
+
+void obj_arena_destroy(obj_arena_t* self)
+{
+    obj_arena_reset(self);
+
+    free(self->_private.chunks);
+    free(self->_private.objects);
+    free(self->_private.scratch);
+    free(self->_private.types);
+
+    memset(self, 0, sizeof(*self));
+}
+
+void* obj_arena_alloc(obj_arena_t* self, size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    if (self->_private.object_count == self->_private.object_cap)
+    {
+        const size_t new_cap = self->_private.object_cap == 0 ? 64 : self->_private.object_cap * 2;
+        obj_t** new_objects = realloc(self->_private.objects, new_cap * sizeof(obj_t*));
+        if (new_objects == NULL)
+        {
+            return NULL;
+        }
+
+        self->_private.objects = new_objects;
+        self->_private.object_cap = new_cap;
+    }
+
+    if ((size_t)(self->_private.end - self->_private.cursor) < size)
+    {
+        const size_t data_size = size > OBJ_ARENA_CHUNK_SIZE ? size : OBJ_ARENA_CHUNK_SIZE;
+        struct __obj_arena_chunk* chunk = malloc(sizeof(struct __obj_arena_chunk) + data_size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+
+        chunk->next = self->_private.chunks;
+        chunk->end = (char*)chunk->data + data_size;
+        self->_private.chunks = chunk;
+        self->_private.cursor = (char*)chunk->data;
+        self->_private.end = chunk->end;
+    }
+
+    obj_t* object = (obj_t*)self->_private.cursor;
+    self->_private.cursor += size;
+
+    // Uninitialized objects are recognized by their empty header.
+    *object = NULL;
+    self->_private.objects[self->_private.object_count++] = object;
+
+    return object;
+}
+
+static struct __obj_arena_type* __obj_arena_probe(struct __obj_arena_type* types,
+                                                  size_t cap,
+                                                  const struct __obj_vtable* vtable)
+{
+    size_t slot = ((uintptr_t)vtable / sizeof(void*)) & (cap - 1);
+    while (types[slot].vtable != vtable && types[slot].vtable != NULL)
+    {
+        slot = (slot + 1) & (cap - 1);
+    }
+
+    return &types[slot];
+}
+
+// Returns the entry of an object's type, adding it if necessary. The destructor is looked up again
+// the first time a type is seen in each reset, since a published vtable may have replaced it.
+static struct __obj_arena_type* __obj_arena_type(obj_arena_t* self, const obj_t* object)
+{
+    const struct __obj_vtable* vtable = __obj_vtable_of(object);
+    struct __obj_arena_type* type = NULL;
+
+    if (self->_private.type_cap != 0)
+    {
+        type = __obj_arena_probe(self->_private.types, self->_private.type_cap, vtable);
+    }
+
+    if (type == NULL || type->vtable == NULL)
+    {
+        if ((self->_private.type_count + 1) * 2 > self->_private.type_cap)
+        {
+            const size_t new_cap = self->_private.type_cap == 0 ? 16 : self->_private.type_cap * 2;
+            struct __obj_arena_type* new_types = calloc(new_cap, sizeof(struct __obj_arena_type));
+            if (new_types == NULL)
+            {
+                return NULL;
+            }
+
+            for (size_t i = 0; i < self->_private.type_cap; i++)
+            {
+                if (self->_private.types[i].vtable != NULL)
+                {
+                    *__obj_arena_probe(new_types, new_cap, self->_private.types[i].vtable) =
+                        self->_private.types[i];
+                }
+            }
+
+            free(self->_private.types);
+            self->_private.types = new_types;
+            self->_private.type_cap = new_cap;
+        }
+
+        type = __obj_arena_probe(self->_private.types, self->_private.type_cap, vtable);
+        type->vtable = vtable;
+        self->_private.type_count++;
+    }
+
+    if (!type->resolved)
+    {
+        type->destroy = (void (*)(obj_t*))obj_find_method(object, "obj_destroy");
+        type->resolved = true;
+    }
+
+    return type;
+}
+
+void obj_arena_reset(obj_arena_t* self)
+{
+    obj_t** objects = self->_private.objects;
+    const size_t object_count = self->_private.object_count;
+    size_t pending = 0;
+
+    // Keep only the objects whose type has a destructor, counting them per type. Neighbouring
+    // objects are usually of the same type, which saves looking the type up.
+    obj_t last = NULL;
+    struct __obj_arena_type* type = NULL;
+    for (size_t i = 0; i < object_count; i++)
+    {
+        obj_t* object = objects[i];
+        if (*object == NULL)
+        {
+            continue;
+        }
+
+        if (*object != last)
+        {
+            type = __obj_arena_type(self, object);
+            if (type == NULL)
+            {
+                // Out of memory, fall back to destroying in place.
+                obj_destroy(object);
+                last = NULL;
+                continue;
+            }
+
+            last = *object;
+        }
+
+        if (type->destroy != NULL)
+        {
+            type->count++;
+            objects[pending++] = object;
+        }
+    }
+
+    if (pending > self->_private.scratch_cap)
+    {
+        obj_t** new_scratch = realloc(self->_private.scratch, pending * sizeof(obj_t*));
+        if (new_scratch != NULL)
+        {
+            self->_private.scratch = new_scratch;
+            self->_private.scratch_cap = pending;
+        }
+    }
+
+    if (pending != 0 && pending <= self->_private.scratch_cap)
+    {
+        // Group the objects by type (a counting sort) and run the destructors one type at a time.
+        size_t offset = 0;
+        for (size_t i = 0; i < self->_private.type_cap; i++)
+        {
+            self->_private.types[i].offset = offset;
+            offset += self->_private.types[i].count;
+        }
+
+        last = NULL;
+        for (size_t i = pending; i > 0; i--)
+        {
+            if (*objects[i - 1] != last)
+            {
+                type = __obj_arena_type(self, objects[i - 1]);
+                last = *objects[i - 1];
+            }
+
+            self->_private.scratch[type->offset++] = objects[i - 1];
+        }
+
+        obj_t** scratch = self->_private.scratch;
+        for (size_t i = 0; i < self->_private.type_cap; i++)
+        {
+            const struct __obj_arena_type* entry = &self->_private.types[i];
+            void (*destroy)(obj_t*) = entry->destroy;
+
+            for (size_t j = entry->offset - entry->count; j < entry->offset; j++)
+            {
+                destroy(scratch[j]);
+            }
+        }
+    }
+    else
+    {
+        // Out of memory, destroy in reverse allocation order instead.
+        for (size_t i = pending; i > 0; i--)
+        {
+            obj_destroy(objects[i - 1]);
+        }
+    }
+
+    for (size_t i = 0; i < self->_private.type_cap; i++)
+    {
+        self->_private.types[i].count = 0;
+        self->_private.types[i].resolved = false;
+    }
+
+    // Keep the most recent block around for reuse.
+    struct __obj_arena_chunk* chunk = self->_private.chunks;
+    if (chunk != NULL)
+    {
+        while (chunk->next != NULL)
+        {
+            struct __obj_arena_chunk* next = chunk->next->next;
+            free(chunk->next);
+            chunk->next = next;
+        }
+
+        self->_private.cursor = (char*)chunk->data;
+        self->_private.end = chunk->end;
+    }
+
+    self->_private.object_count = 0;
+}
+
+// Emissions of a signal are tracked like lookups of patched types, but with counters of the signal
+// itself, so that a writer only waits for emissions of the signal it changes.
+static thread_local size_t __obj_emit_depth;
+
+void obj_signal_create(obj_signal_t* self)
+{
+    if (mtx_init(&self->_private.lock, mtx_plain) != thrd_success)
+    {
+        fputs("Could not initialize signal lock\n", stderr);
+        abort();
+    }
+
+    atomic_init(&self->_private.slots, NULL);
+    atomic_init(&self->_private.epoch, 0);
+    atomic_init(&self->_private.readers[0], 0);
+    atomic_init(&self->_private.readers[1], 0);
+    self->_private.retired = NULL;
+}
+
+static void __obj_slots_free(struct __obj_slots* slots)
+{
+    while (slots != NULL)
+    {
+        struct __obj_slots* retired = slots->retired;
+        free(slots);
+        slots = retired;
+    }
+}
+
+void obj_signal_destroy(obj_signal_t* self)
+{
+    free(atomic_load_explicit(&self->_private.slots, memory_order_relaxed));
+    __obj_slots_free(self->_private.retired);
+    mtx_destroy(&self->_private.lock);
+}
+
+// Copies the current subscribers into a new array with room for extra more subscribers. Must be
+// called with the lock of the signal held.
+static struct __obj_slots* __obj_signal_copy(obj_signal_t* self, size_t extra)
+{
+    struct __obj_slots* slots = atomic_load_explicit(&self->_private.slots, memory_order_relaxed);
+    const size_t count = slots == NULL ? 0 : slots->count;
+
+    struct __obj_slots* new_slots =
+        malloc(sizeof(*new_slots) + (count + extra) * sizeof(struct __obj_slot));
+    if (new_slots == NULL)
+    {
+        return NULL;
+    }
+
+    new_slots->retired = NULL;
+    new_slots->count = count;
+    if (count != 0)
+    {
+        memcpy(new_slots->slots, slots->slots, count * sizeof(struct __obj_slot));
+    }
+
+    return new_slots;
+}
+
+// Publishes a new array and frees the replaced one once no emission of the signal can be using it.
+// Must be called with the lock of the signal held. From within a subscriber, waiting could wait
+// for the calling thread itself, or for a thread that waits for it in turn, so the array is freed
+// by a later change instead.
+static void __obj_signal_replace(obj_signal_t* self, struct __obj_slots* slots)
+{
+    struct __obj_slots* previous =
+        atomic_exchange_explicit(&self->_private.slots, slots, memory_order_acq_rel);
+    if (previous == NULL)
+    {
+        return;
+    }
+
+    if (__obj_emit_depth != 0)
+    {
+        previous->retired = self->_private.retired;
+        self->_private.retired = previous;
+        return;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        const unsigned parity = atomic_fetch_add(&self->_private.epoch, 1) & 1;
+        while (atomic_load(&self->_private.readers[parity]) != 0)
+        {
+            thrd_yield();
+        }
+    }
+
+    previous->retired = self->_private.retired;
+    self->_private.retired = NULL;
+    __obj_slots_free(previous);
+}
+
+int obj_signal_connect(obj_signal_t* self, obj_t* object, const char* method)
+{
+    void (*impl)(void) = obj_find_method(object, method);
+    if (impl == NULL)
+    {
+        return ENOENT;
+    }
+
+    mtx_lock(&self->_private.lock);
+
+    struct __obj_slots* slots = __obj_signal_copy(self, 1);
+    if (slots == NULL)
+    {
+        mtx_unlock(&self->_private.lock);
+        return ENOMEM;
+    }
+
+    slots->slots[slots->count++] = (struct __obj_slot){
+        .object = object,
+        .impl = (void (*)(obj_t*, void*, const char*))impl,
+        .name = method,
+    };
+    __obj_signal_replace(self, slots);
+
+    mtx_unlock(&self->_private.lock);
+    return 0;
+}
+
+int obj_signal_disconnect(obj_signal_t* self, obj_t* object, const char* method)
+{
+    mtx_lock(&self->_private.lock);
+
+    struct __obj_slots* slots = atomic_load_explicit(&self->_private.slots, memory_order_relaxed);
+    size_t index = 0;
+    while (slots != NULL && index < slots->count &&
+           (slots->slots[index].object != object || strcmp(slots->slots[index].name, method) != 0))
+    {
+        index++;
+    }
+
+    if (slots == NULL || index == slots->count)
+    {
+        mtx_unlock(&self->_private.lock);
+        return ENOENT;
+    }
+
+    slots = __obj_signal_copy(self, 0);
+    if (slots == NULL)
+    {
+        mtx_unlock(&self->_private.lock);
+        return ENOMEM;
+    }
+
+    slots->count--;
+    memmove(&slots->slots[index],
+            &slots->slots[index + 1],
+            (slots->count - index) * sizeof(struct __obj_slot));
+    __obj_signal_replace(self, slots);
+
+    mtx_unlock(&self->_private.lock);
+    return 0;
+}
+
+void obj_signal_emit(const obj_signal_t* self, void* arg)
+{
+    if (atomic_load_explicit(&self->_private.slots, memory_order_relaxed) == NULL)
+    {
+        return;
+    }
+
+    // The array stays valid until the counter is released, even if it is replaced meanwhile.
+    obj_signal_t* signal = (obj_signal_t*)self;
+    const unsigned parity = atomic_load(&signal->_private.epoch) & 1;
+    atomic_long* counter = &signal->_private.readers[parity];
+    atomic_fetch_add(counter, 1);
+    __obj_emit_depth++;
+
+    const struct __obj_slots* slots =
+        atomic_load_explicit(&self->_private.slots, memory_order_acquire);
+    for (size_t i = 0; slots != NULL && i < slots->count; i++)
+    {
+        slots->slots[i].impl(slots->slots[i].object, arg, slots->slots[i].name);
+    }
+
+    __obj_emit_depth--;
+    atomic_fetch_sub_explicit(counter, 1, memory_order_release);
+}
+
+static int64_t __obj_load_int(const char* data, size_t size)
+{
+    switch (size)
+    {
+    case sizeof(int8_t): {
+        int8_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    case sizeof(int16_t): {
+        int16_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    case sizeof(int32_t): {
+        int32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    default: {
+        int64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    }
+}
+
+static uint64_t __obj_load_uint(const char* data, size_t size)
+{
+    switch (size)
+    {
+    case sizeof(uint8_t): {
+        uint8_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    case sizeof(uint16_t): {
+        uint16_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    case sizeof(uint32_t): {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    default: {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    }
+}
+
+static long double __obj_load_float(const char* data, size_t size)
+{
+    if (size == sizeof(float))
+    {
+        float value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    if (size == sizeof(double))
+    {
+        double value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    long double value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static const char* __obj_load_str(const char* data)
+{
+    const char* value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Integers wider than 8 bytes are compared as raw memory.
+static int __obj_field_kind(const struct __obj_field* field)
+{
+    if ((field->kind == __OBJ_FIELD_INT || field->kind == __OBJ_FIELD_UINT) &&
+        field->size > sizeof(uint64_t))
+    {
+        return __OBJ_FIELD_BYTES;
+    }
+
+    return field->kind;
+}
+
+// Integer and raw fields compare equal iff their memory is equal.
+static bool __obj_field_is_raw(const struct __obj_field* field)
+{
+    return field->kind == __OBJ_FIELD_BYTES || field->kind == __OBJ_FIELD_INT ||
+           field->kind == __OBJ_FIELD_UINT;
+}
+
+static int __obj_field_cmp(const struct __obj_field* field, const char* a, const char* b)
+{
+    a += field->offset;
+    b += field->offset;
+
+    switch (__obj_field_kind(field))
+    {
+    case __OBJ_FIELD_INT: {
+        const int64_t x = __obj_load_int(a, field->size);
+        const int64_t y = __obj_load_int(b, field->size);
+        return (x > y) - (x < y);
+    }
+    case __OBJ_FIELD_UINT: {
+        const uint64_t x = __obj_load_uint(a, field->size);
+        const uint64_t y = __obj_load_uint(b, field->size);
+        return (x > y) - (x < y);
+    }
+    case __OBJ_FIELD_FLOAT: {
+        const long double x = __obj_load_float(a, field->size);
+        const long double y = __obj_load_float(b, field->size);
+
+        // NaNs are equal to each other and greater than every number, so that the order is total.
+        const bool x_nan = isnan(x);
+        const bool y_nan = isnan(y);
+        if (x_nan || y_nan)
+        {
+            return x_nan - y_nan;
+        }
+
+        return (x > y) - (x < y);
+    }
+    case __OBJ_FIELD_STR: {
+        const char* x = __obj_load_str(a);
+        const char* y = __obj_load_str(b);
+        if (x == NULL || y == NULL)
+        {
+            return (x != NULL) - (y != NULL);
+        }
+        return strcmp(x, y);
+    }
+    default:
+        return memcmp(a, b, field->size);
+    }
+}
+
+// Mixing constants from wyhash/murmur3.
+#define OBJ_HASH_K0 0xa0761d6478bd642full
+#define OBJ_HASH_K1 0xe7037ed1a0b428dbull
+#define OBJ_HASH_K2 0x8ebc6af09c88c6e3ull
+#define OBJ_HASH_K3 0x589965cc75374cc3ull
+
+static uint64_t __obj_hash_mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t __obj_hash_word(uint64_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * OBJ_HASH_K0;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t __obj_hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    const size_t total = size;
+
+    // Four independent lanes so that the main loop can be vectorized (or at least pipelined).
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = {
+            hash ^ OBJ_HASH_K0,
+            hash ^ OBJ_HASH_K1,
+            hash ^ OBJ_HASH_K2,
+            hash ^ OBJ_HASH_K3,
+        };
+
+        for (; size >= 32; size -= 32, bytes += 32)
+        {
+            for (size_t i = 0; i < 4; i++)
+            {
+                uint64_t word;
+                memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+                lanes[i] = __obj_hash_word(lanes[i], word);
+            }
+        }
+
+        hash = lanes[0] ^ (lanes[1] * OBJ_HASH_K1) ^ (lanes[2] * OBJ_HASH_K2) ^
+               (lanes[3] * OBJ_HASH_K3);
+    }
+
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), bytes += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = __obj_hash_word(hash, word);
+    }
+
+    if (size != 0)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        hash = __obj_hash_word(hash, word);
+    }
+
+    return __obj_hash_word(hash, total);
+}
+
+static uint64_t __obj_hash_field(uint64_t hash, const struct __obj_field* field, const char* data)
+{
+    data += field->offset;
+
+    switch (__obj_field_kind(field))
+    {
+    case __OBJ_FIELD_FLOAT: {
+        // Hash by value so that 0.0 and -0.0 hash the same, and so do all NaNs.
+        double value = (double)__obj_load_float(data, field->size);
+        if (value == 0)
+        {
+            value = 0;
+        }
+        else if (isnan(value))
+        {
+            value = NAN;
+        }
+
+        uint64_t word;
+        memcpy(&word, &value, sizeof(word));
+        return __obj_hash_word(hash, word);
+    }
+    case __OBJ_FIELD_STR: {
+        const char* value = __obj_load_str(data);
+        if (value == NULL)
+        {
+            return __obj_hash_word(hash, 0);
+        }
+        return __obj_hash_bytes(hash, value, strlen(value));
+    }
+    default:
+        return __obj_hash_bytes(hash, data, field->size);
+    }
+}
+
+int obj_cmp(const obj_t* self, const obj_t* other)
+{
+    const size_t self_size = obj_sizeof(self);
+    const size_t other_size = obj_sizeof(other);
+
+    if (self_size != other_size)
+    {
+        return self_size < other_size ? -1 : 1;
+    }
+
+    void (*method)(void) = obj_find_method(self, __func__);
+    if (method != NULL)
+    {
+        return ((int (*)(const obj_t*, const obj_t*, size_t))method)(self, other, self_size);
+    }
+
+    if (__obj_vtable_of(self) != __obj_vtable_of(other))
+    {
+        return obj_typeid(self) < obj_typeid(other) ? -1 : 1;
+    }
+
+    const struct __obj_vtable* vtable = __obj_vtable_of(self);
+    if (vtable->_private.field_count == 0)
+    {
+        return memcmp(self + 1, other + 1, self_size - sizeof(obj_t));
+    }
+
+    for (size_t i = 0; i < vtable->_private.field_count; i++)
+    {
+        const int result =
+            __obj_field_cmp(&vtable->_private.fields[i], (const char*)self, (const char*)other);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+bool obj_equals(const obj_t* self, const obj_t* other)
+{
+    void (*method)(void) = obj_find_method(self, __func__);
+    if (method != NULL)
+    {
+        return ((bool (*)(const obj_t*, const obj_t*))method)(self, other);
+    }
+
+    if (obj_find_method(self, "obj_cmp") != NULL)
+    {
+        return obj_cmp(self, other) == 0;
+    }
+
+    if (__obj_vtable_of(self) != __obj_vtable_of(other))
+    {
+        return false;
+    }
+
+    const struct __obj_vtable* vtable = __obj_vtable_of(self);
+    const size_t size = obj_sizeof(self);
+    if (vtable->_private.field_count == 0)
+    {
+        return memcmp(self + 1, other + 1, size - sizeof(obj_t)) == 0;
+    }
+
+    const char* a = (const char*)self;
+    const char* b = (const char*)other;
+    const struct __obj_field* fields = vtable->_private.fields;
+    const size_t count = vtable->_private.field_count;
+
+    for (size_t i = 0; i < count;)
+    {
+        if (!__obj_field_is_raw(&fields[i]))
+        {
+            if (__obj_field_cmp(&fields[i], a, b) != 0)
+            {
+                return false;
+            }
+            i++;
+            continue;
+        }
+
+        // Merge adjacent raw fields into a single block so that memcmp can use wide loads.
+        const size_t start = fields[i].offset;
+        size_t end = start + fields[i].size;
+        for (i++; i < count && __obj_field_is_raw(&fields[i]) && fields[i].offset == end; i++)
+        {
+            end += fields[i].size;
+        }
+
+        if (memcmp(a + start, b + start, end - start) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t obj_hash(const obj_t* self)
+{
+    void (*method)(void) = obj_find_method(self, __func__);
+    if (method != NULL)
+    {
+        return ((size_t(*)(const obj_t*))method)(self);
+    }
+
+    const struct __obj_vtable* vtable = __obj_vtable_of(self);
+    const size_t size = obj_sizeof(self);
+    uint64_t hash = __obj_hash_word(OBJ_HASH_K3, size);
+
+    if (vtable->_private.field_count == 0)
+    {
+        return (size_t)__obj_hash_mix(__obj_hash_bytes(hash, self + 1, size - sizeof(obj_t)));
+    }
+
+    const char* data = (const char*)self;
+    const struct __obj_field* fields = vtable->_private.fields;
+    const size_t count = vtable->_private.field_count;
+
+    for (size_t i = 0; i < count;)
+    {
+        if (!__obj_field_is_raw(&fields[i]))
+        {
+            hash = __obj_hash_field(hash, &fields[i], data);
+            i++;
+            continue;
+        }
+
+        // Same block merging as in obj_equals.
+        const size_t start = fields[i].offset;
+        size_t end = start + fields[i].size;
+        for (i++; i < count && __obj_field_is_raw(&fields[i]) && fields[i].offset == end; i++)
+        {
+            end += fields[i].size;
+        }
+
+        hash = __obj_hash_bytes(hash, data + start, end - start);
     }
 
-    return ((int (*)(const obj_t*, const obj_t*, size_t))method)(self, other, self_size);
+    return (size_t)__obj_hash_mix(hash);
 }
@@ -36,14 +36,27 @@
  * This library aims to provide support for object-oriented programming in C.
  */
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <threads.h>
 
 /**
  * The maximum number of methods allowed for an object.
  */
 #define OBJ_METHODS_MAX 64
 
+/**
+ * The maximum depth of a type hierarchy, counting the root type.
+ */
+#define OBJ_DEPTH_MAX 8
+
+/**
+ * The maximum number of types that can be registered with obj_type_register.
+ */
+#define OBJ_TYPES_MAX 256
+
 /**
  * Marker for structs that want to be handled as libobj objects.
  *
@@ -52,6 +65,36 @@
  */
 #define OBJ_HEADER const struct __obj_vtable* __vptr;
 
+/**
+ * Marker for structs that want to be handled as libobj objects derived from another type.
+ *
+ * This replaces OBJ_HEADER and should be the first thing inside a struct. The members of the parent
+ * type are accessible through OBJ_BASE.
+ *
+ * @code
+ *
+ * typedef struct
+ * {
+ *     OBJ_EXTENDS(shape_t)
+ *     double radius;
+ * } circle_t;
+ *
+ * @endcode
+ *
+ * @param T The parent type.
+ */
+#define OBJ_EXTENDS(T)                                                                             \
+    union                                                                                          \
+    {                                                                                              \
+        T __base;                                                                                  \
+        OBJ_HEADER                                                                                 \
+    };
+
+/**
+ * Converts a T* to a pointer to its parent type, where T is declared with OBJ_EXTENDS.
+ */
+#define OBJ_BASE(x) (&(x)->__base)
+
 /**
  * Initializes an objects' vtable.
  *
@@ -79,13 +122,137 @@
  * @see OBJ_METHOD
  */
 #define OBJ_VTABLE_INIT(T, ...)                                                                    \
-    static const struct __obj_vtable __##T##_vtable = {                                            \
+    static struct __obj_vtable __##T##_vtable = {                                                  \
+        ._private.size = sizeof(T),                                                                \
+        ._private.name = #T,                                                                       \
+        ._private.ancestors = {&__##T##_vtable},                                                   \
+        ._private.methods = {__VA_ARGS__},                                                         \
+    };                                                                                             \
+    self->__vptr = &__##T##_vtable;
+
+/**
+ * Initializes an objects' vtable and registers a field list with it.
+ *
+ * This behaves exactly like OBJ_VTABLE_INIT. The registered fields are used by the default
+ * implementations of obj_cmp, obj_equals and obj_hash, which then only look at the listed members
+ * (in the order they are listed) instead of the raw object memory. Padding, the object header and
+ * any unlisted members are ignored.
+ *
+ * @code
+ *
+ * int point_init(point_t* self, int x, int y) {
+ *     OBJ_VTABLE_INIT_FIELDS(point_t,
+ *                            OBJ_FIELDS(OBJ_FIELD(point_t, x), OBJ_FIELD(point_t, y)),
+ *                            OBJ_METHOD(obj_write));
+ *     ...
+ * }
+ *
+ * @endcode
+ *
+ * @param T The type of an object (this must be the typedef alias not the struct tag).
+ * @param field_list The field list, created with OBJ_FIELDS. This must not be empty.
+ * @param ... The method list for the type. This can be empty.
+ *
+ * @see OBJ_VTABLE_INIT
+ * @see OBJ_FIELD
+ */
+#define OBJ_VTABLE_INIT_FIELDS(T, field_list, ...)                                                 \
+    static const struct __obj_field __##T##_fields[] = {__LIBOBJ_UNPACK field_list};               \
+    static struct __obj_vtable __##T##_vtable = {                                                  \
         ._private.size = sizeof(T),                                                                \
         ._private.name = #T,                                                                       \
+        ._private.fields = __##T##_fields,                                                         \
+        ._private.field_count = sizeof(__##T##_fields) / sizeof(__##T##_fields[0]),                \
+        ._private.ancestors = {&__##T##_vtable},                                                   \
         ._private.methods = {__VA_ARGS__},                                                         \
     };                                                                                             \
     self->__vptr = &__##T##_vtable;
 
+/**
+ * Initializes the vtable of a derived type.
+ *
+ * This works like OBJ_VTABLE_INIT, except that it must come right after a call to the parent
+ * type's initialization function. The first time it runs, the parent's methods are merged into
+ * the type's vtable, with the methods listed here taking precedence. The resulting vtable is flat,
+ * so method calls never have to consult the parent.
+ *
+ * @code
+ *
+ * int circle_init(circle_t* self, double radius) {
+ *     shape_init(OBJ_BASE(self));
+ *     OBJ_VTABLE_INIT_DERIVED(circle_t, OBJ_METHOD(shape_area));
+ *
+ *     self->radius = radius;
+ *     ...
+ * }
+ *
+ * @endcode
+ *
+ * @param T The type of an object, declared with OBJ_EXTENDS.
+ * @param ... The method list for the type. This can be empty.
+ *
+ * @see OBJ_EXTENDS
+ * @see obj_is_a
+ */
+#define OBJ_VTABLE_INIT_DERIVED(T, ...)                                                            \
+    static struct __obj_vtable __##T##_vtable = {                                                  \
+        ._private.size = sizeof(T),                                                                \
+        ._private.name = #T,                                                                       \
+        ._private.methods = {__VA_ARGS__},                                                         \
+    };                                                                                             \
+    self->__vptr = __obj_vtable_derive(&__##T##_vtable, self->__vptr);
+
+/**
+ * Initializes the vtable of a derived type and registers a field list with it.
+ *
+ * This works like OBJ_VTABLE_INIT_DERIVED. The listed fields are compared after the ones inherited
+ * from the parent type.
+ *
+ * @param T The type of an object, declared with OBJ_EXTENDS.
+ * @param field_list The field list, created with OBJ_FIELDS. This must not be empty.
+ * @param ... The method list for the type. This can be empty.
+ *
+ * @see OBJ_VTABLE_INIT_DERIVED
+ * @see OBJ_VTABLE_INIT_FIELDS
+ */
+#define OBJ_VTABLE_INIT_DERIVED_FIELDS(T, field_list, ...)                                         \
+    static const struct __obj_field __##T##_fields[] = {__LIBOBJ_UNPACK field_list};               \
+    static struct __obj_vtable __##T##_vtable = {                                                  \
+        ._private.size = sizeof(T),                                                                \
+        ._private.name = #T,                                                                       \
+        ._private.fields = __##T##_fields,                                                         \
+        ._private.field_count = sizeof(__##T##_fields) / sizeof(__##T##_fields[0]),                \
+        ._private.methods = {__VA_ARGS__},                                                         \
+    };                                                                                             \
+    self->__vptr = __obj_vtable_derive(&__##T##_vtable, self->__vptr);
+
+/**
+ * Groups field entries into a field list for OBJ_VTABLE_INIT_FIELDS.
+ *
+ * @param ... The field entries, created with OBJ_FIELD.
+ */
+#define OBJ_FIELDS(...) (__VA_ARGS__)
+
+/**
+ * Creates a field entry.
+ *
+ * The way a field is compared and hashed is deduced from its type, ignoring const. Integers are
+ * compared by value, floating point numbers by value (so that 0.0 and -0.0 are equal, and NaNs are
+ * equal to each other and greater than any number), char* fields are treated as NUL-terminated
+ * strings and everything else (arrays, nested structs, pointers) is compared byte by byte.
+ * Bit-fields are not supported.
+ *
+ * @param T The type of an object.
+ * @param member The name of the member.
+ *
+ * @see OBJ_VTABLE_INIT_FIELDS
+ */
+#define OBJ_FIELD(T, member)                                                                       \
+    {                                                                                              \
+        .name = #member, .offset = offsetof(T, member), .size = sizeof(((T*)0)->member),           \
+        .kind = __OBJ_FIELD_KIND(&((T*)0)->member),                                                \
+    }
+
 /**
  * Creates a method entry.
  *
@@ -203,6 +370,65 @@ size_t obj_sizeof(const obj_t* self);
  */
 uintptr_t obj_typeid(const obj_t* self);
 
+/**
+ * Checks whether an object is of a type or derived from it.
+ *
+ * This takes constant time regardless of the depth of the hierarchy.
+ *
+ * @param self The object.
+ * @param type The type id of the type to check for, as returned by obj_typeid.
+ * @return true if the object's type is the type or one of its descendants, otherwise false.
+ *
+ * @see OBJ_VTABLE_INIT_DERIVED
+ */
+bool obj_is_a(const obj_t* self, uintptr_t type);
+
+/**
+ * Registers an object's type so that objects of it can be made relocatable.
+ *
+ * Registered types get dense ids in registration order. Processes that share relocatable objects
+ * must register the same types in the same order, which is the case for processes forked after
+ * registration.
+ *
+ * @param prototype An initialized object of the type.
+ * @param id Set to the type's id. This may be NULL.
+ * @return 0 on success, ENOSPC if OBJ_TYPES_MAX types are already registered. Registering a type
+ *         again succeeds and yields the same id.
+ */
+int obj_type_register(const obj_t* prototype, size_t* id);
+
+/**
+ * Makes an object independent of the address space it lives in.
+ *
+ * The object header normally points to the type's vtable, which is only meaningful in the process
+ * that initialized the object. A relocatable object's header instead holds its registered type id,
+ * which each process resolves through its own type table. Relocatable objects can therefore be
+ * placed in shared memory or a mapped file and used from any process that registered the type,
+ * provided their members contain no process-local pointers either. Apart from a slightly more
+ * expensive vtable access, relocatable objects behave exactly like regular ones, including their
+ * type id.
+ *
+ * @code
+ *
+ * point_t* point = mmap(NULL, sizeof(point_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+ *                       -1, 0);
+ * point_init(point, 1, 2);
+ * obj_type_register(OBJ(point), NULL);
+ * obj_make_relocatable(OBJ(point));
+ *
+ * if (fork() == 0)
+ * {
+ *     obj_print_vtable(OBJ(point));
+ *     ...
+ * }
+ *
+ * @endcode
+ *
+ * @param self The initialized object.
+ * @return 0 on success, ENOENT if the object's type is not registered.
+ */
+int obj_make_relocatable(obj_t* self);
+
 /**
  * Prints information about an object's vtable to stderr.
  *
@@ -212,6 +438,92 @@ uintptr_t obj_typeid(const obj_t* self);
  */
 void obj_print_vtable(const obj_t* self);
 
+/**
+ * A modifiable copy of a type's method table.
+ *
+ * A type's methods can be replaced at runtime by cloning its vtable, changing the clone and
+ * publishing it. All objects of the type, existing and new, then dispatch through the published
+ * table. This is useful for selecting implementations once the CPU features are known:
+ *
+ * @code
+ *
+ * obj_vtable_t* vtable = obj_vtable_clone(OBJ(&matrix));
+ * if (cpu_has_avx2())
+ * {
+ *     OBJ_VTABLE_SET(vtable, matrix_multiply, matrix_multiply_avx2_impl);
+ * }
+ * obj_vtable_publish(OBJ(&matrix), vtable);
+ *
+ * @endcode
+ *
+ * Method lookups never lock. Lookups of a type that has never been patched cost nothing extra,
+ * while lookups of a patched type briefly register with a per-thread reader counter, which is what
+ * lets a replaced table be freed once no lookup can still be using it.
+ *
+ * Types derived before a patch keep the methods they inherited; types derived afterwards inherit
+ * the patched methods. Signal subscribers keep the implementation that was resolved when they
+ * subscribed.
+ *
+ * obj_vtable_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct __obj_vtable obj_vtable_t;
+
+/**
+ * Sets a method of a cloned vtable.
+ *
+ * @param vtable The cloned vtable.
+ * @param method The method to set.
+ * @param function The new implementation.
+ * @return 0 on success, ENOSPC if the method is new and the vtable already has OBJ_METHODS_MAX
+ *         methods.
+ *
+ * @see obj_vtable_set
+ */
+#define OBJ_VTABLE_SET(vtable, method, function)                                                   \
+    obj_vtable_set(vtable, #method, (void (*)(void))(function))
+
+/**
+ * Creates a modifiable copy of the methods currently in use for an object's type.
+ *
+ * @param self The object.
+ * @return The copy, or NULL on allocation failure. It must be passed to obj_vtable_publish or
+ *         obj_vtable_discard.
+ */
+obj_vtable_t* obj_vtable_clone(const obj_t* self);
+
+/**
+ * Adds or replaces a method of a cloned vtable. This must be done before publishing it.
+ *
+ * @param vtable The cloned vtable.
+ * @param name The name of the method. It must stay valid as long as the vtable is in use.
+ * @param impl The implementation.
+ * @return 0 on success, ENOSPC if the method is new and the vtable already has OBJ_METHODS_MAX
+ *         methods.
+ */
+int obj_vtable_set(obj_vtable_t* vtable, const char* name, void (*impl)(void));
+
+/**
+ * Makes a cloned vtable the one used by all objects of a type.
+ *
+ * This waits for lookups that may be using the previously published table and then frees it. The
+ * wait happens without holding the lock that signals and other types use. When called from a
+ * signal subscriber the table is instead freed after a later call that waits for lookups.
+ * Interface tables resolved with the old methods are dropped from the cache, although pointers
+ * already obtained from obj_query_interface remain valid.
+ *
+ * @param self An object of the type the vtable was cloned from.
+ * @param vtable The cloned vtable, or NULL to restore the type's original methods.
+ * @return 0 on success, EINVAL if the vtable was cloned from a different type.
+ */
+int obj_vtable_publish(const obj_t* self, obj_vtable_t* vtable);
+
+/**
+ * Frees a cloned vtable that was never published.
+ *
+ * @param vtable The cloned vtable.
+ */
+void obj_vtable_discard(obj_vtable_t* vtable);
+
 /**
  * Searches for a method with the specified name.
  *
@@ -221,10 +533,104 @@ void obj_print_vtable(const obj_t* self);
  */
 void (*obj_find_method(const obj_t* self, const char* name))(void);
 
+/**
+ * Describes an interface, a group of methods that are looked up together.
+ *
+ * An interface consists of a struct of function pointers, one for each method, and a description
+ * created with OBJ_INTERFACE. obj_query_interface then resolves all methods of an interface for a
+ * type at once.
+ *
+ * obj_interface_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        size_t size;
+        size_t count;
+        const struct __obj_interface_method* methods;
+    } _private;
+} obj_interface_t;
+
+/**
+ * Defines an interface.
+ *
+ * This must be used at file scope. To use the interface from other files declare it as an extern
+ * const obj_interface_t.
+ *
+ * @code
+ *
+ * typedef struct
+ * {
+ *     int (*stream_write_byte)(obj_t* self, uint8_t byte);
+ *     int (*stream_read_byte)(obj_t* self);
+ * } stream_t;
+ *
+ * OBJ_INTERFACE(STREAM_IFACE,
+ *               stream_t,
+ *               OBJ_INTERFACE_METHOD(stream_t, stream_write_byte),
+ *               OBJ_INTERFACE_METHOD(stream_t, stream_read_byte));
+ *
+ * @endcode
+ *
+ * @param id The name of the interface description.
+ * @param T The function pointer struct.
+ * @param ... The method entries, created with OBJ_INTERFACE_METHOD.
+ *
+ * @see obj_query_interface
+ */
+#define OBJ_INTERFACE(id, T, ...)                                                                  \
+    static const struct __obj_interface_method __##id##_methods[] = {__VA_ARGS__};                 \
+    const obj_interface_t id = {                                                                   \
+        ._private.size = sizeof(T),                                                                \
+        ._private.count = sizeof(__##id##_methods) / sizeof(__##id##_methods[0]),                  \
+        ._private.methods = __##id##_methods,                                                      \
+    }
+
+/**
+ * Creates an interface method entry.
+ *
+ * @param T The function pointer struct.
+ * @param method The name of the method, which must also be the name of the struct member.
+ *
+ * @see OBJ_INTERFACE
+ */
+#define OBJ_INTERFACE_METHOD(T, method)                                                            \
+    {                                                                                              \
+        .name = #method, .offset = offsetof(T, method),                                            \
+    }
+
+/**
+ * Resolves the methods of an interface for an object's type.
+ *
+ * The result is cached per type and interface, so only the first query for a type does any method
+ * lookups. Calls through the returned struct are plain indirect calls. Unlike OBJ_CALL, no hidden
+ * method name argument is passed.
+ *
+ * @code
+ *
+ * const stream_t* stream = obj_query_interface(OBJ(&file), &STREAM_IFACE);
+ * if (stream != NULL)
+ * {
+ *     stream->stream_write_byte(OBJ(&file), 255);
+ * }
+ *
+ * @endcode
+ *
+ * @param self The object.
+ * @param interface The interface, defined with OBJ_INTERFACE.
+ * @return The function pointer struct, or NULL if the type does not implement every method of the
+ *         interface. This is valid for the lifetime of the program.
+ */
+const void* obj_query_interface(const obj_t* self, const obj_interface_t* interface);
+
 /**
  * Compares two objects.
  *
- * This can be specialized by the obj_cmp vtable entry. Default behavior is to compare via memcpy.
+ * This can be specialized by the obj_cmp vtable entry. Default behavior is to compare the
+ * registered fields in order (see OBJ_VTABLE_INIT_FIELDS) or, for types without registered fields,
+ * the object memory following the header via memcmp. Objects of different types are ordered by
+ * their size and then by their type id.
  *
  * @param self The object.
  * @param other The object to compare to.
@@ -232,6 +638,33 @@ void (*obj_find_method(const obj_t* self, const char* name))(void);
  */
 int obj_cmp(const obj_t* self, const obj_t* other);
 
+/**
+ * Checks two objects for equality.
+ *
+ * This can be specialized by the obj_equals vtable entry. If the type only specializes obj_cmp
+ * then that is used instead. Default behavior is to compare the registered fields, where adjacent
+ * integer and raw fields are compared as a single block, or the object memory following the
+ * header for types without registered fields. Objects of different types are never equal.
+ *
+ * @param self The object.
+ * @param other The object to compare to.
+ * @return true if the objects are equal, otherwise false.
+ */
+bool obj_equals(const obj_t* self, const obj_t* other);
+
+/**
+ * Returns a hash value for an object.
+ *
+ * This can be specialized by the obj_hash vtable entry. Default behavior is to hash the registered
+ * fields, or the object memory following the header for types without registered fields. Objects
+ * that compare equal with obj_equals have equal hashes, provided obj_equals is not specialized
+ * without also specializing obj_hash.
+ *
+ * @param self The object.
+ * @return The hash value.
+ */
+size_t obj_hash(const obj_t* self);
+
 /**
  * Calls the destructor for an object.
  *
@@ -244,24 +677,409 @@ void obj_destroy(obj_t* object);
 /**
  * Returns a string representation of an object.
  *
- * This can be specialized by the obj_to_string vtable entry. Default behavior is to return an
- * implementation-defined string.
+ * This can be specialized by the obj_to_string vtable entry. Otherwise the representation is built
+ * with obj_write.
  *
  * @param self The object.
- * @return The object's string representation. This is a malloc()'d C string and is owned by the
- *         caller of the function.
+ * @return The object's string representation, or NULL on allocation failure. This is a malloc()'d
+ *         C string and is owned by the caller of the function.
+ *
+ * @see obj_format
  */
 char* obj_to_string(const obj_t* self);
 
+/**
+ * The default capacity of a growable writer.
+ */
+#define OBJ_WRITER_DEFAULT_CAP 64
+
+/**
+ * A character sink that object representations are written into.
+ *
+ * A writer either wraps caller provided storage of a fixed capacity, in which case output is
+ * truncated, or owns a growable heap buffer that is meant to be reused across many objects. In both
+ * cases the written data is always NUL-terminated.
+ *
+ * obj_writer_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        char* data;
+        size_t size;
+        size_t cap;
+        bool growable;
+    } _private;
+} obj_writer_t;
+
+/**
+ * Initializes a growable writer.
+ *
+ * @param self The writer.
+ * @param capacity The initial capacity. A value of 0 is the same as OBJ_WRITER_DEFAULT_CAP.
+ * @return 0 on success, ENOMEM on allocation failure.
+ */
+int obj_writer_create(obj_writer_t* self, size_t capacity);
+
+/**
+ * Destroys a growable writer.
+ *
+ * @param self The writer.
+ */
+void obj_writer_destroy(obj_writer_t* self);
+
+/**
+ * Discards the contents of a writer, keeping its storage.
+ *
+ * @param self The writer.
+ */
+void obj_writer_clear(obj_writer_t* self);
+
+/**
+ * Returns the contents of a writer as a C string.
+ *
+ * @param self The writer.
+ * @return The NUL-terminated contents. This is owned by the writer.
+ */
+const char* obj_writer_data(const obj_writer_t* self);
+
+/**
+ * Returns the number of characters written to a writer.
+ *
+ * For fixed writers this may exceed the available storage, in which case the output was truncated.
+ *
+ * @param self The writer.
+ * @return The number of characters written, not including the NUL terminator.
+ */
+size_t obj_writer_size(const obj_writer_t* self);
+
+/**
+ * Appends characters to a writer.
+ *
+ * @param self The writer.
+ * @param data The characters.
+ * @param size The number of characters.
+ * @return 0 on success, ENOMEM on allocation failure.
+ */
+int obj_writer_write(obj_writer_t* self, const char* data, size_t size);
+
+/**
+ * Appends a C string to a writer.
+ *
+ * @param self The writer.
+ * @param string The string.
+ * @return 0 on success, ENOMEM on allocation failure.
+ */
+int obj_writer_puts(obj_writer_t* self, const char* string);
+
+/**
+ * Appends printf() style formatted output to a writer.
+ *
+ * @param self The writer.
+ * @param format The format string.
+ * @param ... The format arguments.
+ * @return 0 on success, EINVAL on formatting errors, ENOMEM on allocation failure.
+ */
+int obj_writer_printf(obj_writer_t* self, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Writes the string representation of an object to a writer.
+ *
+ * This can be specialized by the obj_write vtable entry, whose implementation receives the writer
+ * as its second parameter and returns 0 or an error code. Types that only specialize obj_to_string
+ * are supported as well, although that allocates. Default behavior is to write the type name.
+ *
+ * @param self The object.
+ * @param writer The writer.
+ * @return 0 on success, otherwise an error code.
+ */
+int obj_write(const obj_t* self, obj_writer_t* writer);
+
+/**
+ * Formats the string representation of an object into a buffer.
+ *
+ * This works like snprintf(): the output is truncated to fit the buffer and is always
+ * NUL-terminated (unless capacity is 0).
+ *
+ * @param self The object.
+ * @param buffer The buffer.
+ * @param capacity The size of the buffer.
+ * @return The length of the complete string representation. If this is not less than capacity
+ *         the output was truncated.
+ */
+size_t obj_format(const obj_t* self, char* buffer, size_t capacity);
+
+/**
+ * The size of the memory blocks an object arena allocates from.
+ */
+#define OBJ_ARENA_CHUNK_SIZE 65536
+
+/**
+ * An allocator for objects that are destroyed together.
+ *
+ * Objects are allocated contiguously from large blocks. On reset the destructors of all allocated
+ * objects run grouped by type, with objects of types that do not specialize obj_destroy skipped
+ * entirely, and the memory is released in one go.
+ *
+ * @code
+ * obj_arena_t arena;
+ * obj_arena_create(&arena);
+ *
+ * for (size_t i = 0; i < count; i++)
+ * {
+ *     file_t* file = obj_arena_alloc(&arena, sizeof(file_t));
+ *     file_open(file, paths[i], FILE_READ);
+ * }
+ *
+ * // Closes all files.
+ * obj_arena_reset(&arena);
+ * @endcode
+ *
+ * obj_arena_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        struct __obj_arena_chunk* chunks;
+        char* cursor;
+        char* end;
+        obj_t** objects;
+        size_t object_count;
+        size_t object_cap;
+        obj_t** scratch;
+        size_t scratch_cap;
+        struct __obj_arena_type* types;
+        size_t type_cap;
+        size_t type_count;
+    } _private;
+} obj_arena_t;
+
+/**
+ * Initializes an object arena. No memory is allocated until the first object is.
+ *
+ * @param self The arena.
+ */
+void obj_arena_create(obj_arena_t* self);
+
+/**
+ * Destroys all objects in an arena and releases all its memory.
+ *
+ * @param self The arena.
+ */
+void obj_arena_destroy(obj_arena_t* self);
+
+/**
+ * Allocates memory for an object.
+ *
+ * The memory is suitably aligned for any type. The object must be initialized with its
+ * initialization function before the arena is reset; objects that never get initialized are
+ * ignored. Objects allocated from an arena must not be destroyed with obj_destroy.
+ *
+ * @param self The arena.
+ * @param size The size of the object.
+ * @return The object's memory, or NULL on allocation failure.
+ */
+void* obj_arena_alloc(obj_arena_t* self, size_t size);
+
+/**
+ * Destroys all objects in an arena and releases their memory.
+ *
+ * Destructors run grouped by type. Within a type they run in reverse allocation order, but there is
+ * no ordering between types. Each type's destructor is looked up once per reset, so methods
+ * published with obj_vtable_publish are honoured. The arena keeps one block of memory for reuse.
+ *
+ * @param self The arena.
+ */
+void obj_arena_reset(obj_arena_t* self);
+
+/**
+ * An event that objects can subscribe to.
+ *
+ * Subscribers are (object, method) pairs. The method is looked up once when subscribing and the
+ * resolved pairs are kept in a contiguous array, so emitting calls each subscriber with a single
+ * indirect call. Emitting never takes a lock and may happen from any number of threads while
+ * subscribers are added or removed. Each change replaces the array with an updated copy, and the
+ * replaced array is freed once no emission can still be using it. Connecting or disconnecting
+ * therefore waits for emissions of the same signal in progress, unless it happens from within a
+ * subscriber. Emissions are tracked per signal, so other signals and obj_vtable_publish never
+ * wait for them.
+ *
+ * @code
+ * void button_clicked_impl(obj_t* self, void* arg, const char* name)
+ * {
+ *     ...
+ * }
+ *
+ * obj_signal_t clicked;
+ * obj_signal_create(&clicked);
+ * OBJ_CONNECT(&clicked, OBJ(&button), button_clicked);
+ * obj_signal_emit(&clicked, &event);
+ * @endcode
+ *
+ * obj_signal_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        _Atomic(struct __obj_slots*) slots;
+        mtx_t lock;
+        atomic_uint epoch;
+        atomic_long readers[2];
+        struct __obj_slots* retired;
+    } _private;
+} obj_signal_t;
+
+/**
+ * Subscribes an object's method to a signal.
+ *
+ * @param signal The signal.
+ * @param object The object.
+ * @param method The method to call.
+ * @return 0 on success, ENOENT if the object has no such method, ENOMEM on allocation failure.
+ *
+ * @see obj_signal_connect
+ */
+#define OBJ_CONNECT(signal, object, method) obj_signal_connect(signal, object, #method)
+
+/**
+ * Initializes a signal with no subscribers.
+ *
+ * @param self The signal.
+ */
+void obj_signal_create(obj_signal_t* self);
+
+/**
+ * Destroys a signal. No emission may be in progress.
+ *
+ * @param self The signal.
+ */
+void obj_signal_destroy(obj_signal_t* self);
+
+/**
+ * Subscribes an object's method to a signal.
+ *
+ * The method is called as void method(obj_t* self, void* arg, const char* name), where arg is the
+ * argument passed to obj_signal_emit(). Subscribing the same pair twice makes it called twice.
+ *
+ * @param self The signal.
+ * @param object The object. It must stay alive while subscribed.
+ * @param method The name of the method. It must stay valid while subscribed.
+ * @return 0 on success, ENOENT if the object has no such method, ENOMEM on allocation failure.
+ */
+int obj_signal_connect(obj_signal_t* self, obj_t* object, const char* method);
+
+/**
+ * Unsubscribes an object's method from a signal.
+ *
+ * An emission already in progress may still call the method.
+ *
+ * @param self The signal.
+ * @param object The object.
+ * @param method The name of the method.
+ * @return 0 on success, ENOENT if the pair is not subscribed, ENOMEM on allocation failure.
+ */
+int obj_signal_disconnect(obj_signal_t* self, obj_t* object, const char* method);
+
+/**
+ * Calls every subscriber of a signal, in subscription order.
+ *
+ * Subscribers must return normally, since leaving an emission with longjmp or an exception would
+ * make every later connect and disconnect of the signal wait forever.
+ *
+ * @param self The signal.
+ * @param arg The argument passed to every subscriber.
+ */
+void obj_signal_emit(const obj_signal_t* self, void* arg);
+
 #ifndef DOXYGEN
 #define __LIBOBJ_FIRST(a, ...) a
+#define __LIBOBJ_UNPACK(...)   __VA_ARGS__
+#define __OBJ_FIELD_BYTES      0
+#define __OBJ_FIELD_INT        1
+#define __OBJ_FIELD_UINT       2
+#define __OBJ_FIELD_FLOAT      3
+#define __OBJ_FIELD_STR        4
+#define __OBJ_FIELD_KIND(ptr)                                                                      \
+    _Generic((ptr), signed char*                                                                   \
+             : __OBJ_FIELD_INT, short*                                                             \
+             : __OBJ_FIELD_INT, int*                                                               \
+             : __OBJ_FIELD_INT, long*                                                              \
+             : __OBJ_FIELD_INT, long long*                                                         \
+             : __OBJ_FIELD_INT, char*                                                              \
+             : __OBJ_FIELD_UINT, _Bool*                                                            \
+             : __OBJ_FIELD_UINT, unsigned char*                                                    \
+             : __OBJ_FIELD_UINT, unsigned short*                                                   \
+             : __OBJ_FIELD_UINT, unsigned int*                                                     \
+             : __OBJ_FIELD_UINT, unsigned long*                                                    \
+             : __OBJ_FIELD_UINT, unsigned long long*                                               \
+             : __OBJ_FIELD_UINT, float*                                                            \
+             : __OBJ_FIELD_FLOAT, double*                                                          \
+             : __OBJ_FIELD_FLOAT, long double*                                                     \
+             : __OBJ_FIELD_FLOAT, const signed char*                                               \
+             : __OBJ_FIELD_INT, const short*                                                       \
+             : __OBJ_FIELD_INT, const int*                                                         \
+             : __OBJ_FIELD_INT, const long*                                                        \
+             : __OBJ_FIELD_INT, const long long*                                                   \
+             : __OBJ_FIELD_INT, const char*                                                        \
+             : __OBJ_FIELD_UINT, const _Bool*                                                      \
+             : __OBJ_FIELD_UINT, const unsigned char*                                              \
+             : __OBJ_FIELD_UINT, const unsigned short*                                             \
+             : __OBJ_FIELD_UINT, const unsigned int*                                               \
+             : __OBJ_FIELD_UINT, const unsigned long*                                              \
+             : __OBJ_FIELD_UINT, const unsigned long long*                                         \
+             : __OBJ_FIELD_UINT, const float*                                                      \
+             : __OBJ_FIELD_FLOAT, const double*                                                    \
+             : __OBJ_FIELD_FLOAT, const long double*                                               \
+             : __OBJ_FIELD_FLOAT, char**                                                           \
+             : __OBJ_FIELD_STR, const char**                                                       \
+             : __OBJ_FIELD_STR, char* const*                                                       \
+             : __OBJ_FIELD_STR, const char* const*                                                 \
+             : __OBJ_FIELD_STR, default                                                            \
+             : __OBJ_FIELD_BYTES)
 void (*__obj_get_method(const obj_t*, const char*))(void);
+const struct __obj_vtable* __obj_vtable_of(const obj_t*);
+const struct __obj_vtable* __obj_vtable_derive(struct __obj_vtable*, const struct __obj_vtable*);
+struct __obj_interface_method
+{
+    const char* name;
+    size_t offset;
+};
+struct __obj_slot
+{
+    obj_t* object;
+    void (*impl)(obj_t*, void*, const char*);
+    const char* name;
+};
+struct __obj_slots
+{
+    struct __obj_slots* retired;
+    size_t count;
+    struct __obj_slot slots[];
+};
+struct __obj_field
+{
+    const char* name;
+    size_t offset;
+    size_t size;
+    int kind;
+};
 struct __obj_vtable
 {
     struct
     {
         size_t size;
         const char* name;
+        const struct __obj_field* fields;
+        size_t field_count;
+        size_t depth;
+        const struct __obj_vtable* ancestors[OBJ_DEPTH_MAX];
+        atomic_bool derived;
+        _Atomic(const struct __obj_vtable*) patched;
+        atomic_size_t type_id;
         struct
         {
             const char* name;
@@ -0,0 +1,443 @@
+//
+// The MIT License (MIT)
+//
+// Copyright (c)  2022 Vasilis Mylonas
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include "objser.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OBJSER_MAGIC       "OBJSER\0\1"
+#define OBJSER_VERSION     1
+#define OBJSER_ALIGN       16
+#define OBJSER_CACHE_SIZE  16
+#define OBJSER_STR_NULL    0
+#define OBJSER_STR_PRESENT 1
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct __objser_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct __objser_record
+{
+    uint32_t type_id;
+    uint32_t size;
+    uint64_t schema_hash;
+};
+
+struct __objser_schema
+{
+    const struct __obj_vtable* vtable;
+    uint32_t type_id;
+    uint64_t schema_hash;
+    size_t str_count;
+};
+
+static_assert(sizeof(struct __objser_header) == OBJSER_ALIGN, "Unexpected snapshot header size");
+static_assert(sizeof(struct __objser_record) == OBJSER_ALIGN, "Unexpected record header size");
+
+static const char __objser_zero[OBJSER_ALIGN];
+static const char __objser_str_tags[] = {OBJSER_STR_NULL, OBJSER_STR_PRESENT};
+
+static uint64_t __objser_fnv(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static void __objser_schema_init(struct __objser_schema* self, const obj_t* object)
+{
+    const struct __obj_vtable* vtable = __obj_vtable_of(object);
+    const char* name = obj_typeof(object);
+    const size_t size = obj_sizeof(object);
+
+    self->vtable = vtable;
+    self->type_id = (uint32_t)__objser_fnv(0xcbf29ce484222325ull, name, strlen(name));
+    self->str_count = 0;
+
+    uint64_t hash = __objser_fnv(0xcbf29ce484222325ull, name, strlen(name) + 1);
+    hash = __objser_fnv(hash, &size, sizeof(size));
+
+    for (size_t i = 0; i < vtable->_private.field_count; i++)
+    {
+        const struct __obj_field* field = &vtable->_private.fields[i];
+        hash = __objser_fnv(hash, field->name, strlen(field->name) + 1);
+        hash = __objser_fnv(hash, &field->offset, sizeof(field->offset));
+        hash = __objser_fnv(hash, &field->size, sizeof(field->size));
+        hash = __objser_fnv(hash, &field->kind, sizeof(field->kind));
+
+        if (field->kind == __OBJ_FIELD_STR)
+        {
+            self->str_count++;
+        }
+    }
+
+    self->schema_hash = hash;
+}
+
+static size_t __objser_padding(size_t size)
+{
+    return (OBJSER_ALIGN - size % OBJSER_ALIGN) % OBJSER_ALIGN;
+}
+
+// Writes out all of iov, handling partial writes.
+static int __objser_writev(int fd, struct iovec* iov, size_t count)
+{
+    while (count != 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        while (count != 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count != 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+static void __objser_push(objser_writer_t* self, const void* data, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    self->_private.iov[self->_private.iov_count].iov_base = (void*)data;
+    self->_private.iov[self->_private.iov_count].iov_len = size;
+    self->_private.iov_count++;
+}
+
+int objser_writer_create(objser_writer_t* self, int fd)
+{
+    static const struct __objser_header header = {
+        .magic = OBJSER_MAGIC,
+        .version = OBJSER_VERSION,
+    };
+
+    self->_private.fd = fd;
+    self->_private.iov_count = 0;
+    self->_private.iov_cap = IOV_MAX;
+    self->_private.record_count = 0;
+    self->_private.iov = malloc(IOV_MAX * sizeof(struct iovec));
+    self->_private.records = malloc(OBJSER_BATCH_MAX * sizeof(struct __objser_record));
+    self->_private.schemas = calloc(OBJSER_CACHE_SIZE, sizeof(struct __objser_schema));
+
+    if (self->_private.iov == NULL || self->_private.records == NULL ||
+        self->_private.schemas == NULL)
+    {
+        free(self->_private.iov);
+        free(self->_private.records);
+        free(self->_private.schemas);
+        return ENOMEM;
+    }
+
+    __objser_push(self, &header, sizeof(header));
+    return 0;
+}
+
+int objser_writer_destroy(objser_writer_t* self)
+{
+    const int result = objser_writer_flush(self);
+
+    free(self->_private.iov);
+    free(self->_private.records);
+    free(self->_private.schemas);
+
+    return result;
+}
+
+int objser_writer_flush(objser_writer_t* self)
+{
+    const int result =
+        __objser_writev(self->_private.fd, self->_private.iov, self->_private.iov_count);
+
+    self->_private.iov_count = 0;
+    self->_private.record_count = 0;
+
+    return result;
+}
+
+int objser_write(objser_writer_t* self, const obj_t* object)
+{
+    // Bulk snapshots usually contain runs of the same type, so remember the schema of recent ones.
+    const struct __obj_vtable* vtable = __obj_vtable_of(object);
+    struct __objser_schema* schema =
+        &self->_private.schemas[((uintptr_t)vtable / sizeof(void*)) % OBJSER_CACHE_SIZE];
+    if (schema->vtable != vtable)
+    {
+        __objser_schema_init(schema, object);
+    }
+
+    // Record header, zeroed vtable slot, object body, a tag and string per char* field, padding.
+    const size_t iov_needed = 4 + 2 * schema->str_count;
+    if (iov_needed > self->_private.iov_cap)
+    {
+        return EMSGSIZE;
+    }
+
+    if (self->_private.iov_count + iov_needed > self->_private.iov_cap ||
+        self->_private.record_count == OBJSER_BATCH_MAX)
+    {
+        const int result = objser_writer_flush(self);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+
+    const size_t object_size = obj_sizeof(object);
+    struct __objser_record* record = &self->_private.records[self->_private.record_count++];
+    record->type_id = schema->type_id;
+    record->schema_hash = schema->schema_hash;
+
+    __objser_push(self, record, sizeof(*record));
+    __objser_push(self, __objser_zero, sizeof(obj_t));
+    __objser_push(self, object + 1, object_size - sizeof(obj_t));
+
+    size_t size = sizeof(*record) + object_size;
+
+    for (size_t i = 0; schema->str_count != 0 && i < vtable->_private.field_count; i++)
+    {
+        const struct __obj_field* field = &vtable->_private.fields[i];
+        if (field->kind != __OBJ_FIELD_STR)
+        {
+            continue;
+        }
+
+        const char* string;
+        memcpy(&string, (const char*)object + field->offset, sizeof(string));
+
+        __objser_push(self, &__objser_str_tags[string != NULL], 1);
+        size++;
+
+        if (string != NULL)
+        {
+            const size_t length = strlen(string) + 1;
+            __objser_push(self, string, length);
+            size += length;
+        }
+    }
+
+    const size_t padding = __objser_padding(size);
+    __objser_push(self, __objser_zero, padding);
+    record->size = (uint32_t)(size + padding);
+
+    return 0;
+}
+
+int objser_reader_create(objser_reader_t* self, int fd)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        return errno;
+    }
+
+    if ((size_t)info.st_size < sizeof(struct __objser_header))
+    {
+        return EBADMSG;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return errno;
+    }
+
+    const struct __objser_header* header = data;
+    if (memcmp(header->magic, OBJSER_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != OBJSER_VERSION)
+    {
+        munmap(data, info.st_size);
+        return EBADMSG;
+    }
+
+    self->_private.types = calloc(OBJSER_TYPES_MAX, sizeof(struct __objser_schema));
+    if (self->_private.types == NULL)
+    {
+        munmap(data, info.st_size);
+        return ENOMEM;
+    }
+
+    self->_private.data = data;
+    self->_private.size = info.st_size;
+    self->_private.offset = sizeof(struct __objser_header);
+    self->_private.type_count = 0;
+
+    return 0;
+}
+
+void objser_reader_destroy(objser_reader_t* self)
+{
+    munmap(self->_private.data, self->_private.size);
+    free(self->_private.types);
+
+    self->_private.data = NULL;
+    self->_private.types = NULL;
+}
+
+int objser_reader_register(objser_reader_t* self, const obj_t* prototype)
+{
+    if (self->_private.type_count == OBJSER_TYPES_MAX)
+    {
+        return ENOSPC;
+    }
+
+    struct __objser_schema* schema = &self->_private.types[self->_private.type_count];
+    __objser_schema_init(schema, prototype);
+
+    // Types are told apart by both hashes, so names whose ids collide can still be registered.
+    for (size_t i = 0; i < self->_private.type_count; i++)
+    {
+        if (self->_private.types[i].type_id == schema->type_id &&
+            self->_private.types[i].schema_hash == schema->schema_hash)
+        {
+            return EEXIST;
+        }
+    }
+
+    self->_private.type_count++;
+    return 0;
+}
+
+int objser_read(objser_reader_t* self, obj_t** object)
+{
+    const size_t remaining = self->_private.size - self->_private.offset;
+    if (remaining == 0)
+    {
+        return ENODATA;
+    }
+
+    char* start = self->_private.data + self->_private.offset;
+    const struct __objser_record* record = (const struct __objser_record*)start;
+
+    if (remaining < sizeof(*record) || record->size < sizeof(*record) ||
+        record->size > remaining || record->size % OBJSER_ALIGN != 0)
+    {
+        return EBADMSG;
+    }
+
+    self->_private.offset += record->size;
+
+    // A type whose id matches but whose schema does not is either a colliding name or a changed
+    // layout, which is only an error if no other registered type matches.
+    const struct __objser_schema* schema = NULL;
+    bool id_found = false;
+    for (size_t i = 0; i < self->_private.type_count && schema == NULL; i++)
+    {
+        if (self->_private.types[i].type_id == record->type_id)
+        {
+            id_found = true;
+            if (self->_private.types[i].schema_hash == record->schema_hash)
+            {
+                schema = &self->_private.types[i];
+            }
+        }
+    }
+
+    if (schema == NULL)
+    {
+        return id_found ? EPROTO : ENOENT;
+    }
+
+    const size_t object_size = schema->vtable->_private.size;
+    char* end = start + record->size;
+    char* body = start + sizeof(*record);
+    if (object_size > (size_t)(end - body))
+    {
+        return EBADMSG;
+    }
+
+    // Point char* fields at the strings following the object.
+    char* cursor = body + object_size;
+    for (size_t i = 0; schema->str_count != 0 && i < schema->vtable->_private.field_count; i++)
+    {
+        const struct __obj_field* field = &schema->vtable->_private.fields[i];
+        if (field->kind != __OBJ_FIELD_STR)
+        {
+            continue;
+        }
+
+        if (cursor == end)
+        {
+            return EBADMSG;
+        }
+
+        char* string = NULL;
+        if (*cursor++ == OBJSER_STR_PRESENT)
+        {
+            const size_t length = strnlen(cursor, end - cursor);
+            if (length == (size_t)(end - cursor))
+            {
+                return EBADMSG;
+            }
+
+            string = cursor;
+            cursor += length + 1;
+        }
+
+        memcpy(body + field->offset, &string, sizeof(string));
+    }
+
+    *(obj_t*)body = schema->vtable;
+    *object = (obj_t*)body;
+
+    return 0;
+}
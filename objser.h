@@ -0,0 +1,221 @@
+//
+// The MIT License (MIT)
+//
+// Copyright (c)  2022 Vasilis Mylonas
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef OBJSER_H
+#define OBJSER_H
+
+/**
+ * @file objser.h
+ * @author Vasilis Mylonas <vasilismylonas@protonmail.com>
+ * @brief Binary serialization of libobj objects.
+ * @version 0.1
+ * @date 2022-04-24
+ * @copyright Copyright (c) 2022 Vasilis Mylonas
+ *
+ * libobjser writes libobj objects into a compact binary snapshot and reads them back in place from
+ * a memory-mapped file. It is driven by the field lists registered with OBJ_VTABLE_INIT_FIELDS.
+ *
+ * Every object is stored as a record consisting of a 16 byte header (type id, record size and a
+ * schema hash covering the type name, size and field layout) followed by the object memory and the
+ * contents of any char* fields. Records are padded so that objects stay suitably aligned inside the
+ * mapping, which allows the reader to hand out pointers into the mapping instead of copying. Only
+ * the vtable pointer and char* fields are patched on load.
+ *
+ * Snapshots use the native byte order and layout, so they are only portable between processes
+ * built for the same ABI. Registered pointer fields other than char* and unregistered members are
+ * stored as raw memory and are meaningless when read back.
+ *
+ * Writing:
+ *
+ * @code
+ * objser_writer_t writer;
+ * objser_writer_create(&writer, fd);
+ *
+ * for (size_t i = 0; i < count; i++)
+ * {
+ *     objser_write(&writer, OBJ(&points[i]));
+ * }
+ *
+ * objser_writer_destroy(&writer);
+ * @endcode
+ *
+ * Reading:
+ *
+ * @code
+ * point_t prototype;
+ * point_init(&prototype, 0, 0);
+ *
+ * objser_reader_t reader;
+ * objser_reader_create(&reader, fd);
+ * objser_reader_register(&reader, OBJ(&prototype));
+ *
+ * obj_t* object;
+ * while (objser_read(&reader, &object) == 0)
+ * {
+ *     ...
+ * }
+ *
+ * objser_reader_destroy(&reader);
+ * @endcode
+ */
+
+#include "obj.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * The maximum number of records buffered by a writer before they are written out.
+ */
+#define OBJSER_BATCH_MAX 256
+
+/**
+ * The maximum number of types that can be registered with a reader.
+ */
+#define OBJSER_TYPES_MAX 64
+
+/**
+ * Writes objects into a file descriptor.
+ *
+ * Records are gathered and written with a single writev() call per batch, directly from the
+ * objects' memory. Objects must therefore not be modified or destroyed until the next
+ * objser_writer_flush() (or until the writer is destroyed).
+ *
+ * objser_writer_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        int fd;
+        struct iovec* iov;
+        size_t iov_count;
+        size_t iov_cap;
+        struct __objser_record* records;
+        size_t record_count;
+        struct __objser_schema* schemas;
+    } _private;
+} objser_writer_t;
+
+/**
+ * Reads objects from a memory-mapped file descriptor.
+ *
+ * objser_reader_t should be considered an opaque type and any members are considered private.
+ */
+typedef struct
+{
+    struct
+    {
+        char* data;
+        size_t size;
+        size_t offset;
+        size_t type_count;
+        struct __objser_schema* types;
+    } _private;
+} objser_reader_t;
+
+/**
+ * Initializes a writer and writes the snapshot header.
+ *
+ * @param self The writer.
+ * @param fd The file descriptor to write to. This is not owned by the writer.
+ * @return 0 on success, ENOMEM on allocation failure, otherwise an errno value from writev().
+ */
+int objser_writer_create(objser_writer_t* self, int fd);
+
+/**
+ * Flushes and destroys a writer.
+ *
+ * @param self The writer.
+ * @return 0 on success, otherwise an errno value from writev().
+ */
+int objser_writer_destroy(objser_writer_t* self);
+
+/**
+ * Writes all buffered records.
+ *
+ * @param self The writer.
+ * @return 0 on success, otherwise an errno value from writev().
+ */
+int objser_writer_flush(objser_writer_t* self);
+
+/**
+ * Appends an object to the snapshot.
+ *
+ * @param self The writer.
+ * @param object The object. This is referenced, not copied, until the next flush.
+ * @return 0 on success, EMSGSIZE if the object has too many char* fields, otherwise an errno value
+ *         from writev().
+ */
+int objser_write(objser_writer_t* self, const obj_t* object);
+
+/**
+ * Maps a snapshot for reading.
+ *
+ * The mapping is private, so patching objects in place never modifies the file.
+ *
+ * @param self The reader.
+ * @param fd The file descriptor to read from. This is not owned by the reader and may be closed
+ *           afterwards.
+ * @return 0 on success, EBADMSG if this is not a snapshot, ENOMEM on allocation failure, otherwise
+ *         an errno value from fstat() or mmap().
+ */
+int objser_reader_create(objser_reader_t* self, int fd);
+
+/**
+ * Unmaps a snapshot. All objects returned by the reader become invalid.
+ *
+ * @param self The reader.
+ */
+void objser_reader_destroy(objser_reader_t* self);
+
+/**
+ * Registers a type with a reader.
+ *
+ * Records can only be read back if their type has been registered with the same name, size and
+ * field layout.
+ *
+ * @param self The reader.
+ * @param prototype Any initialized object of the type.
+ * @return 0 on success, EEXIST if the type is already registered, ENOSPC if OBJSER_TYPES_MAX
+ *         types are already registered.
+ */
+int objser_reader_register(objser_reader_t* self, const obj_t* prototype);
+
+/**
+ * Reads the next object in place.
+ *
+ * The returned object lives inside the mapping and is valid until the reader is destroyed. It must
+ * not be passed to obj_destroy().
+ *
+ * @param self The reader.
+ * @param object Receives the object.
+ * @return 0 on success, ENODATA at the end of the snapshot, ENOENT if the type of the record is
+ *         not registered (the record is skipped), EPROTO if the registered type has a different
+ *         layout (the record is skipped), EBADMSG if the snapshot is corrupt.
+ */
+int objser_read(objser_reader_t* self, obj_t** object);
+
+#endif // OBJSER_H
@@ -1,15 +1,25 @@
 #define BENCHMARK_RUNS 1000
 
+#include "actor.h"
 #include "benchmark.h"
 #include "defer.h"
 #include "except.h"
+#include "obj.h"
+#include "objser.h"
 #include "vec.h"
 
 #include <assert.h>
+#include <math.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 void vec_create_destroy_test()
 {
@@ -128,23 +138,1571 @@ void test_no_throw()
     assert(exec_finally);
 }
 
+typedef struct
+{
+    int* destroyed;
+} tracked_error_t;
+
+static void tracked_error_destroy(void* error)
+{
+    (*((tracked_error_t*)error)->destroyed)++;
+}
+
+EXCEPT_DECLARE(tracked_error_t);
+EXCEPT_DEFINE_DESTROY(tracked_error_t, tracked_error_destroy);
+
+void test_throw_type()
+{
+    assert(EXCEPT_TYPE(tracked_error_t) != EXCEPT_TYPE(int));
+    assert(EXCEPT_TYPE(signed) == EXCEPT_TYPE(int));
+    assert(strcmp(EXCEPT_TYPE(tracked_error_t)->name, "tracked_error_t") == 0);
+
+    int destroyed = 0;
+    bool exec_catch = false;
+
+    try
+    {
+        try
+        {
+            throw(tracked_error_t, (tracked_error_t){&destroyed});
+        }
+        catch (int, e)
+        {
+            assert(false);
+        }
+    }
+    catch (tracked_error_t, e)
+    {
+        exec_catch = e.destroyed == &destroyed;
+        assert(destroyed == 0);
+    }
+
+    assert(exec_catch);
+    assert(destroyed == 1);
+}
+
+void test_throw_derived()
+{
+    bool exec_catch = false;
+
+    try
+    {
+        access_violation_t error = {.message = "test", .address = NULL};
+        throw(access_violation_t, error);
+    }
+    catch (arithmetic_error_t, e)
+    {
+        assert(false);
+    }
+    catch (memory_error_t, e)
+    {
+        exec_catch = strcmp(e.message, "test") == 0;
+    }
+
+    assert(exec_catch);
+
+    // A parent is not caught as its child.
+    exec_catch = false;
+    try
+    {
+        try
+        {
+            throw(memory_error_t, (memory_error_t){0});
+        }
+        catch (access_violation_t, e)
+        {
+            assert(false);
+        }
+    }
+    catch_any
+    {
+        exec_catch = true;
+    }
+
+    assert(exec_catch);
+}
+
+void test_catch_one_of()
+{
+    const except_type_t* caught = NULL;
+
+    try
+    {
+        throw(access_violation_t, (access_violation_t){.message = "test"});
+    }
+    catch (arithmetic_error_t, e)
+    {
+        assert(false);
+    }
+    catch_one_of (e, int, memory_error_t, arithmetic_error_t)
+    {
+        caught = except_typeof(e);
+        assert(strcmp(((access_violation_t*)e)->message, "test") == 0);
+    }
+
+    assert(caught == EXCEPT_TYPE(access_violation_t));
+
+    // Types that do not match fall through to the next clause.
+    caught = NULL;
+    try
+    {
+        throw(int, 42);
+    }
+    catch_one_of (e, arithmetic_error_t, memory_error_t)
+    {
+        assert(false);
+    }
+    catch_one_of (e, double, int)
+    {
+        caught = except_typeof(e);
+        assert(*(int*)e == 42);
+    }
+
+    assert(caught == EXCEPT_TYPE(int));
+}
+
+typedef struct
+{
+    int code;
+    char message[];
+} message_error_t;
+
+static void message_error_format(const void* error, FILE* stream)
+{
+    const message_error_t* message_error = error;
+    fprintf(stream, "%s (%i)", message_error->message, message_error->code);
+}
+
+EXCEPT_DECLARE(message_error_t);
+EXCEPT_DEFINE_EX(message_error_t, .format = message_error_format);
+
+void test_throw_chained()
+{
+    int destroyed = 0;
+    bool exec_catch = false;
+
+    try
+    {
+        throw(tracked_error_t, (tracked_error_t){&destroyed});
+    }
+    catch (tracked_error_t, e)
+    {
+        try
+        {
+            message_error_t* error = EXCEPT_NEW(message_error_t, 256);
+            error->code = 5;
+            strcpy(error->message, "handling failed");
+            except_throw_new(error);
+        }
+        catch (message_error_t, inner)
+        {
+            const message_error_t* error = except_current();
+            assert(except_typeof(error) == EXCEPT_TYPE(message_error_t));
+            assert(strcmp(error->message, "handling failed") == 0);
+
+            // The exception being handled when this one was thrown is its cause.
+            const tracked_error_t* cause = except_cause(error);
+            assert(cause != NULL && except_typeof(cause) == EXCEPT_TYPE(tracked_error_t));
+            assert(except_cause(cause) == NULL);
+
+            FILE* f = fopen("temp.txt", "w+");
+            except_print(error, f);
+            rewind(f);
+            char buffer[128] = {0};
+            fread(buffer, 1, sizeof(buffer) - 1, f);
+            fclose(f);
+            assert(strcmp(buffer,
+                          "message_error_t: handling failed (5)\n"
+                          "Caused by: tracked_error_t\n") == 0);
+        }
+
+        // Only the inner exception has been released.
+        assert(destroyed == 0);
+        assert(except_typeof(except_current()) == EXCEPT_TYPE(tracked_error_t));
+        exec_catch = true;
+    }
+
+    assert(exec_catch);
+    assert(destroyed == 1);
+    assert(except_current() == NULL);
+}
+
+void test_throw_backtrace()
+{
+    if (except_enable_backtrace(8) != 0)
+    {
+        return;
+    }
+
+    size_t count = 0;
+    try
+    {
+        throw(int, 1);
+    }
+    catch (int, e)
+    {
+        assert(except_backtrace(except_current(), &count) != NULL);
+    }
+
+    assert(count > 0 && count <= 8);
+
+    except_enable_backtrace(0);
+}
+
+typedef struct
+{
+    int code;
+} counted_error_t;
+
+EXCEPT_DECLARE(counted_error_t);
+EXCEPT_DEFINE(counted_error_t);
+
+void test_except_stats()
+{
+    // Caught right away.
+    try
+    {
+        throw(counted_error_t, (counted_error_t){1});
+    }
+    catch (counted_error_t, e)
+    {
+    }
+
+    // Caught after propagating through another try block.
+    try
+    {
+        try
+        {
+            throw(counted_error_t, (counted_error_t){2});
+        }
+        catch (int, e)
+        {
+        }
+    }
+    catch (counted_error_t, e)
+    {
+    }
+
+    // Caught, rethrown and caught again.
+    try
+    {
+        try
+        {
+            throw(counted_error_t, (counted_error_t){3});
+        }
+        catch (counted_error_t, e)
+        {
+            break;
+        }
+    }
+    catch (counted_error_t, e)
+    {
+    }
+
+    FILE* f = fopen("temp.txt", "w+");
+    except_stats_dump(f);
+    rewind(f);
+    char buffer[4096] = {0};
+    fread(buffer, 1, sizeof(buffer) - 1, f);
+    fclose(f);
+    assert(strstr(buffer, "\ncounted_error_t 3 4 1 0\n") != NULL);
+    assert(strstr(buffer, "\ndepth catches\n0 ") != NULL);
+}
+
+int future_throw(void* argument)
+{
+    message_error_t* error = EXCEPT_NEW(message_error_t, 32);
+    error->code = *(int*)argument;
+    strcpy(error->message, "failed in thread");
+    except_throw_new(error);
+}
+
+int future_return(void* argument)
+{
+    return *(int*)argument;
+}
+
+int future_throw_tracked(void* argument)
+{
+    throw(tracked_error_t, (tracked_error_t){argument});
+}
+
+void test_except_future()
+{
+    int value = 7;
+    except_future_t future;
+
+    assert(except_future_start(&future, future_return, &value) == 0);
+    assert(except_future_join(&future) == 7);
+
+    bool exec_catch = false;
+    assert(except_future_start(&future, future_throw, &value) == 0);
+    try
+    {
+        except_future_join(&future);
+    }
+    catch (message_error_t, e)
+    {
+        const message_error_t* error = except_current();
+        assert(error->code == 7);
+        assert(strcmp(error->message, "failed in thread") == 0);
+        exec_catch = true;
+    }
+
+    assert(exec_catch);
+
+    // The exception is destroyed once, by the thread that finally handles it.
+    int destroyed = 0;
+    assert(except_future_start(&future, future_throw_tracked, &destroyed) == 0);
+    try
+    {
+        except_future_join(&future);
+    }
+    catch (tracked_error_t, e)
+    {
+        assert(destroyed == 0);
+    }
+
+    assert(destroyed == 1);
+
+    // Captured exceptions can also be dropped.
+    except_captured_t captured = {0};
+    try
+    {
+        throw(tracked_error_t, (tracked_error_t){&destroyed});
+    }
+    catch (tracked_error_t, e)
+    {
+        assert(except_capture(&captured) == 0);
+    }
+
+    assert(destroyed == 1);
+    except_discard(&captured);
+    assert(destroyed == 2);
+    assert(except_capture(&captured) == EINVAL);
+}
+
 void test_signal()
 {
-    except_enable_sigcatch();
+    except_enable_sigcatch();
+
+    bool error_caught = false;
+    try
+    {
+        raise(SIGFPE);
+    }
+    catch (arithmetic_error_t, e)
+    {
+        error_caught = true;
+    }
+
+    assert(error_caught);
+
+    except_disable_sigcatch();
+}
+
+void test_signal_fast()
+{
+    except_enable_sigcatch();
+
+    // The second signal is only delivered if the first handler unblocked it.
+    int caught = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        try_fast
+        {
+            raise(SIGFPE);
+        }
+        catch (arithmetic_error_t, e)
+        {
+            caught++;
+        }
+    }
+
+    assert(caught == 2);
+
+    except_disable_sigcatch();
+}
+
+#ifdef EXCEPT_WITH_DEFER
+static void count_cleanup(void* counter)
+{
+    (*(int*)counter)++;
+}
+
+static void defer_and_throw(int* counter)
+{
+    defer(count_cleanup, counter);
+    throw(int, 1);
+}
+
+static void defer_and_call(int* counter)
+{
+    defer(count_cleanup, counter);
+    defer_and_throw(counter);
+}
+#endif
+
+void test_throw_defer()
+{
+#ifdef EXCEPT_WITH_DEFER
+    // The handlers of both functions run before the catch clause.
+    int counter = 0;
+    void* frame = __defer_frame();
+    try
+    {
+        defer_and_call(&counter);
+    }
+    catch (int, e)
+    {
+        assert(counter == 2);
+        assert(__defer_frame() == frame);
+    }
+
+    assert(counter == 2);
+#endif
+}
+
+typedef struct
+{
+    char digit;
+} digit_error_t;
+
+EXCEPT_DECLARE(digit_error_t);
+EXCEPT_DEFINE(digit_error_t);
+EXCEPT_RESULT_DECLARE(int);
+
+int parse_digit_or_throw(char c)
+{
+    if (c < '0' || c > '9')
+    {
+        throw(digit_error_t, {c});
+    }
+    return c - '0';
+}
+
+EXCEPT_RESULT(int) parse_digit(char c)
+{
+    if (c < '0' || c > '9')
+    {
+        return EXCEPT_ERROR(int, digit_error_t, {c});
+    }
+    return EXCEPT_OK(int, c - '0');
+}
+
+int parse_digit_or_zero(char c)
+{
+    try
+    {
+        return parse_digit_or_throw(c);
+    }
+    catch (digit_error_t, e)
+    {
+    }
+    return 0;
+}
+
+void test_try_result()
+{
+    EXCEPT_RESULT(int) result = try_result(int, parse_digit_or_throw('7'));
+    assert(EXCEPT_RESULT_OK(result) && result.value == 7);
+
+    result = try_result(int, parse_digit_or_throw('x'));
+    assert(!EXCEPT_RESULT_OK(result));
+    const digit_error_t* error = except_captured(&result.error);
+    assert(except_typeof(error) == EXCEPT_TYPE(digit_error_t) && error->digit == 'x');
+    assert(except_current() == NULL);
+    except_discard(&result.error);
+    assert(except_captured(&result.error) == NULL);
+
+    // Exceptions caught inside the function are not affected.
+    result = try_result(int, parse_digit_or_zero('x'));
+    assert(EXCEPT_RESULT_OK(result) && result.value == 0);
+
+    result = parse_digit('3');
+    assert(EXCEPT_UNWRAP(result) == 3);
+
+    bool exec_catch = false;
+    result = parse_digit('y');
+    try
+    {
+        (void)EXCEPT_UNWRAP(result);
+    }
+    catch (digit_error_t, e)
+    {
+        assert(e.digit == 'y');
+        exec_catch = true;
+    }
+
+    assert(exec_catch);
+    assert(EXCEPT_RESULT_OK(result));
+}
+
+static int thread_throws;
+
+static void count_thread_throw(void* exception)
+{
+    (void)exception;
+    thread_throws++;
+}
+
+static int log_thread(void* unused)
+{
+    (void)unused;
+
+    except_thread_on_throw = count_thread_throw;
+    try
+    {
+        throw(long, 1);
+    }
+    catch (long, e)
+    {
+    }
+
+    return 0;
+}
+
+static int late_log_thread(void* unused)
+{
+    (void)unused;
+
+    // The deadline handler finds no log, since logging was off when the block was entered.
+    except_enable_log(false);
+    try_with_deadline (1)
+    {
+        except_enable_log(true);
+        for (volatile int spin = 1; spin;)
+        {
+        }
+    }
+    catch (timeout_error_t, e)
+    {
+    }
+
+    try
+    {
+        throw(int, 0);
+    }
+    catch (int, e)
+    {
+    }
+
+    return 0;
+}
+
+void test_except_log()
+{
+    except_log_entry_t entries[EXCEPT_LOG_SIZE];
+    except_enable_log(true);
+
+    // Only the thread that set the hook calls it.
+    thrd_t thread;
+    assert(thrd_create(&thread, log_thread, NULL) == thrd_success);
+    thrd_join(thread, NULL);
+    try
+    {
+        throw(int, 2);
+    }
+    catch (int, e)
+    {
+    }
+
+    assert(thread_throws == 1);
+
+    // The log of the exited thread is still there.
+    assert(except_log_drain(entries, EXCEPT_LOG_SIZE) == 2);
+    assert(except_log_drain(entries, EXCEPT_LOG_SIZE) == 0);
+
+    // A full log drops throws and reports them with the next logged one.
+    for (int i = 0; i < EXCEPT_LOG_SIZE + 3; i++)
+    {
+        try
+        {
+            throw(int, i);
+        }
+        catch (int, e)
+        {
+        }
+    }
+
+    assert(except_log_drain(entries, EXCEPT_LOG_SIZE) == EXCEPT_LOG_SIZE);
+    assert(entries[0].type == EXCEPT_TYPE(int) && entries[0].site != NULL);
+    assert(entries[EXCEPT_LOG_SIZE - 1].dropped == 0);
+
+    try
+    {
+        throw(int, 0);
+    }
+    catch (int, e)
+    {
+    }
+
+    assert(except_log_drain(entries, 1) == 1);
+    assert(entries[0].dropped == 3);
+
+    assert(thrd_create(&thread, late_log_thread, NULL) == thrd_success);
+    thrd_join(thread, NULL);
+    assert(except_log_drain(entries, EXCEPT_LOG_SIZE) == 1);
+    assert(entries[0].type == EXCEPT_TYPE(int) && entries[0].dropped == 1);
+
+    except_enable_log(false);
+}
+
+// Not instrumented, as libdefer would allocate a frame for every call that is never freed.
+static int __attribute__((no_instrument_function)) recurse(volatile int depth)
+{
+    volatile char buffer[256];
+    buffer[0] = (char)depth;
+    return depth < 0 ? 0 : recurse(depth + 1) + buffer[0];
+}
+
+static int stack_overflow_thread(void* caught)
+{
+    // The signal stack of this thread is set up by the try block.
+    try
+    {
+        recurse(0);
+    }
+    catch (stack_corruption_error_t, e)
+    {
+        *(bool*)caught = true;
+    }
+
+    return 0;
+}
+
+static void spin(volatile bool* running)
+{
+    while (*running)
+    {
+    }
+}
+
+void test_try_with_deadline()
+{
+    volatile bool running = true;
+
+    // Runs to completion, and the timer does not fire afterwards.
+    bool timed_out = false;
+    try_with_deadline (20)
+    {
+    }
+    catch (timeout_error_t, e)
+    {
+        timed_out = true;
+    }
+
+    thrd_sleep(&(struct timespec){.tv_nsec = 40000000}, NULL);
+    assert(!timed_out);
+
+    struct timespec start;
+    struct timespec end;
+    timespec_get(&start, TIME_UTC);
+    try_with_deadline (20)
+    {
+        spin(&running);
+    }
+    catch (timeout_error_t, e)
+    {
+        timed_out = true;
+    }
+
+    timespec_get(&end, TIME_UTC);
+    assert(timed_out);
+    assert((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 >= 19);
+
+    // The inner block cannot outlive the outer one, which times out as well.
+    int inner = 0;
+    int outer = 0;
+    try_with_deadline (20)
+    {
+        try_with_deadline (10000)
+        {
+            spin(&running);
+        }
+        catch (timeout_error_t, e)
+        {
+            inner++;
+        }
+
+        spin(&running);
+    }
+    catch (timeout_error_t, e)
+    {
+        outer++;
+    }
+
+    assert(inner == 1 && outer == 1);
+}
+
+void test_signal_stack_overflow()
+{
+    except_enable_sigcatch();
+
+    bool caught = false;
+    thrd_t thread;
+    assert(thrd_create(&thread, stack_overflow_thread, &caught) == thrd_success);
+    thrd_join(thread, NULL);
+    assert(caught);
+
+    except_disable_sigcatch();
+}
+
+// Not instrumented, as libdefer cannot allocate frames once memory is exhausted.
+static bool __attribute__((no_instrument_function)) throw_out_of_memory()
+{
+    // Use up the heap and forbid growing it.
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    limit.rlim_cur = 0;
+    setrlimit(RLIMIT_AS, &limit);
+
+    for (size_t size = 1 << 20; size >= 16; size /= 2)
+    {
+        while (malloc(size) != NULL)
+        {
+        }
+    }
+
+    // The arena has to fall back to the emergency reserve for both the chunks and the exception.
+    bool caught = false;
+    try
+    {
+        except_alloc(EXCEPT_ARENA_CHUNK_SIZE);
+        except_alloc(EXCEPT_ARENA_CHUNK_SIZE);
+        except_malloc(64);
+    }
+    catch (out_of_memory_error_t, e)
+    {
+        caught = e.size == 64;
+    }
+
+    return caught;
+}
+
+void test_except_malloc()
+{
+    bool caught = false;
+    try
+    {
+        except_malloc(SIZE_MAX);
+    }
+    catch (out_of_memory_error_t, e)
+    {
+        caught = e.size == SIZE_MAX;
+    }
+
+    assert(caught);
+
+    // Failing to resize leaves the memory alone.
+    char* memory = except_malloc(1);
+    *memory = 'x';
+
+    caught = false;
+    try
+    {
+        memory = except_realloc(memory, SIZE_MAX);
+    }
+    catch (out_of_memory_error_t, e)
+    {
+        caught = true;
+    }
+
+    assert(caught && *memory == 'x');
+    free(memory);
+
+#ifdef VEC_WITH_EXCEPT
+    char* chars;
+    vec_create(&chars, 0);
+    vec_push(&chars, &(char){'x'});
+
+    caught = false;
+    try
+    {
+        vec_reserve(&chars, SIZE_MAX / 4);
+    }
+    catch (out_of_memory_error_t, e)
+    {
+        caught = true;
+    }
+
+    assert(caught && vec_size(&chars) == 1 && chars[0] == 'x');
+    vec_destroy(&chars);
+#endif
+
+    fflush(NULL);
+    const pid_t child = fork();
+    assert(child != -1);
+    if (child == 0)
+    {
+        _exit(throw_out_of_memory() ? 0 : 1);
+    }
+
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    char tag;
+    int x;
+    double y;
+    const char* name;
+} point_t;
+
+int obj_write_impl(const obj_t* self, obj_writer_t* writer)
+{
+    const point_t* point = (const point_t*)self;
+    return obj_writer_printf(writer, "%s(%i, %g)", point->name, point->x, point->y);
+}
+
+void point_init(point_t* self, int x, double y, const char* name)
+{
+    OBJ_VTABLE_INIT_FIELDS(point_t,
+                           OBJ_FIELDS(OBJ_FIELD(point_t, x),
+                                      OBJ_FIELD(point_t, y),
+                                      OBJ_FIELD(point_t, name)),
+                           OBJ_METHOD(obj_write));
+
+    self->x = x;
+    self->y = y;
+    self->name = name;
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    const double value;
+} constant_t;
 
-    bool error_caught = false;
-    try
+void constant_init(constant_t* self)
+{
+    OBJ_VTABLE_INIT_FIELDS(constant_t, OBJ_FIELDS(OBJ_FIELD(constant_t, value)));
+}
+
+void test_obj_fields()
+{
+    char name[] = "point";
+    point_t a;
+    point_t b;
+
+    // Garbage in the padding and unregistered members must not matter.
+    memset(&a, 0xaa, sizeof(a));
+    memset(&b, 0x55, sizeof(b));
+
+    point_init(&a, 1, 0.0, "point");
+    point_init(&b, 1, -0.0, name);
+
+    assert(obj_equals(OBJ(&a), OBJ(&b)));
+    assert(obj_cmp(OBJ(&a), OBJ(&b)) == 0);
+    assert(obj_hash(OBJ(&a)) == obj_hash(OBJ(&b)));
+
+    b.x = -1;
+
+    assert(!obj_equals(OBJ(&a), OBJ(&b)));
+    assert(obj_cmp(OBJ(&a), OBJ(&b)) > 0);
+
+    // NaNs are equal to each other and greater than every number.
+    b.x = 1;
+    b.y = NAN;
+
+    assert(!obj_equals(OBJ(&a), OBJ(&b)));
+    assert(obj_cmp(OBJ(&a), OBJ(&b)) < 0);
+
+    a.y = -NAN;
+
+    assert(obj_equals(OBJ(&a), OBJ(&b)));
+    assert(obj_hash(OBJ(&a)) == obj_hash(OBJ(&b)));
+
+    // Const members are compared by value too.
+    constant_t zero = {.value = 0.0};
+    constant_t negative_zero = {.value = -0.0};
+    constant_init(&zero);
+    constant_init(&negative_zero);
+
+    assert(obj_equals(OBJ(&zero), OBJ(&negative_zero)));
+}
+
+void test_obj_format()
+{
+    point_t point;
+    point_init(&point, 1, 2.5, "point");
+
+    char buffer[8];
+    assert(obj_format(OBJ(&point), buffer, sizeof(buffer)) == strlen("point(1, 2.5)"));
+    assert(strcmp(buffer, "point(1") == 0);
+
+    obj_writer_t writer;
+    obj_writer_create(&writer, 1);
+
+    obj_write(OBJ(&point), &writer);
+    obj_writer_puts(&writer, " ");
+    obj_write(OBJ(&point), &writer);
+
+    assert(strcmp(obj_writer_data(&writer), "point(1, 2.5) point(1, 2.5)") == 0);
+
+    obj_writer_destroy(&writer);
+}
+
+typedef struct
+{
+    OBJ_EXTENDS(point_t)
+    int z;
+} point3_t;
+
+void point3_init(point3_t* self, int x, double y, int z)
+{
+    point_init(OBJ_BASE(self), x, y, "point3");
+    OBJ_VTABLE_INIT_DERIVED_FIELDS(point3_t, OBJ_FIELDS(OBJ_FIELD(point3_t, z)));
+
+    self->z = z;
+}
+
+void test_obj_derived()
+{
+    point_t point;
+    point3_t a;
+    point3_t b;
+
+    point_init(&point, 1, 2, "point");
+    point3_init(&a, 1, 2, 3);
+    point3_init(&b, 1, 2, 4);
+
+    assert(obj_is_a(OBJ(&a), obj_typeid(OBJ(&point))));
+    assert(obj_is_a(OBJ(&a), obj_typeid(OBJ(&b))));
+    assert(!obj_is_a(OBJ(&point), obj_typeid(OBJ(&a))));
+
+    // Inherited fields are compared before the derived ones.
+    assert(!obj_equals(OBJ(&a), OBJ(&b)));
+    b.z = 3;
+    assert(obj_equals(OBJ(&a), OBJ(&b)));
+
+    // Methods are inherited.
+    char buffer[32];
+    obj_format(OBJ(&a), buffer, sizeof(buffer));
+    assert(strcmp(buffer, "point3(1, 2)") == 0);
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    long value;
+} counter_t;
+
+void counter_add_impl(obj_t* self, void* payload, const char* name)
+{
+    ((counter_t*)self)->value += *(int*)payload;
+}
+
+void counter_init(counter_t* self)
+{
+    OBJ_VTABLE_INIT(counter_t, OBJ_METHOD(counter_add));
+    self->value = 0;
+}
+
+void test_actor()
+{
+    actor_pool_t pool;
+    assert(actor_pool_create(&pool, 0, 4) == EINVAL);
+    assert(actor_pool_create(&pool, 2, 4) == 0);
+
+    counter_t counters[3];
+    actor_t actors[3];
+    for (size_t i = 0; i < 3; i++)
     {
-        raise(SIGFPE);
+        counter_init(&counters[i]);
+        actor_create(&actors[i], &pool, OBJ(&counters[i]));
     }
-    catch (arithmetic_error_t, e)
+
+    for (int i = 1; i <= 100; i++)
     {
-        error_caught = true;
+        assert(ACTOR_SEND(&actors[i % 3], counter_add, &i) == 0);
     }
 
-    assert(error_caught);
+    char big[ACTOR_PAYLOAD_MAX + 1] = {0};
+    assert(actor_send(&actors[0], "counter_add", big, sizeof(big)) == EMSGSIZE);
 
-    except_disable_sigcatch();
+    actor_pool_wait(&pool);
+    assert(counters[0].value + counters[1].value + counters[2].value == 5050);
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        actor_destroy(&actors[i]);
+    }
+    actor_pool_destroy(&pool);
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    obj_signal_t* signal;
+    int calls;
+} unsubscriber_t;
+
+void unsubscribe_impl(obj_t* self, void* payload, const char* name)
+{
+    unsubscriber_t* unsubscriber = (unsubscriber_t*)self;
+    unsubscriber->calls++;
+    assert(obj_signal_disconnect(unsubscriber->signal, self, name) == 0);
+}
+
+void unsubscriber_init(unsubscriber_t* self, obj_signal_t* signal)
+{
+    OBJ_VTABLE_INIT(unsubscriber_t, OBJ_METHOD(unsubscribe));
+    self->signal = signal;
+    self->calls = 0;
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    atomic_bool entered;
+    atomic_bool released;
+} blocker_t;
+
+void block_impl(obj_t* self, void* payload, const char* name)
+{
+    blocker_t* blocker = (blocker_t*)self;
+    atomic_store(&blocker->entered, true);
+    while (!atomic_load(&blocker->released))
+    {
+        thrd_yield();
+    }
+}
+
+void blocker_init(blocker_t* self)
+{
+    OBJ_VTABLE_INIT(blocker_t, OBJ_METHOD(block));
+    atomic_init(&self->entered, false);
+    atomic_init(&self->released, false);
+}
+
+int emit_thread(void* signal)
+{
+    obj_signal_emit(signal, NULL);
+    return 0;
+}
+
+void test_obj_signal()
+{
+    counter_t a;
+    counter_t b;
+    counter_init(&a);
+    counter_init(&b);
+
+    obj_signal_t signal;
+    obj_signal_create(&signal);
+
+    assert(OBJ_CONNECT(&signal, OBJ(&a), counter_add) == 0);
+    assert(OBJ_CONNECT(&signal, OBJ(&b), counter_add) == 0);
+    assert(OBJ_CONNECT(&signal, OBJ(&a), counter_sub) == ENOENT);
+
+    int amount = 2;
+    obj_signal_emit(&signal, &amount);
+    assert(a.value == 2 && b.value == 2);
+
+    assert(obj_signal_disconnect(&signal, OBJ(&a), "counter_add") == 0);
+    assert(obj_signal_disconnect(&signal, OBJ(&a), "counter_add") == ENOENT);
+
+    obj_signal_emit(&signal, &amount);
+    assert(a.value == 2 && b.value == 4);
+
+    // Replaced arrays are freed as the subscribers change rather than piling up.
+    for (int i = 0; i < 1000; i++)
+    {
+        assert(OBJ_CONNECT(&signal, OBJ(&a), counter_add) == 0);
+        assert(obj_signal_disconnect(&signal, OBJ(&a), "counter_add") == 0);
+    }
+
+    // The array replaced from within the emission outlives it.
+    unsubscriber_t unsubscriber;
+    unsubscriber_init(&unsubscriber, &signal);
+    assert(OBJ_CONNECT(&signal, OBJ(&unsubscriber), unsubscribe) == 0);
+    assert(OBJ_CONNECT(&signal, OBJ(&a), counter_add) == 0);
+    obj_signal_emit(&signal, &amount);
+    obj_signal_emit(&signal, &amount);
+    assert(unsubscriber.calls == 1 && a.value == 6 && b.value == 8);
+
+    // A subscriber that does not return only holds up changes to its own signal.
+    obj_signal_t slow;
+    obj_signal_create(&slow);
+    blocker_t blocker;
+    blocker_init(&blocker);
+    assert(OBJ_CONNECT(&slow, OBJ(&blocker), block) == 0);
+
+    thrd_t thread;
+    assert(thrd_create(&thread, emit_thread, &slow) == thrd_success);
+    while (!atomic_load(&blocker.entered))
+    {
+        thrd_yield();
+    }
+
+    assert(obj_signal_disconnect(&signal, OBJ(&a), "counter_add") == 0);
+    obj_vtable_t* vtable = obj_vtable_clone(OBJ(&a));
+    assert(obj_vtable_publish(OBJ(&a), vtable) == 0);
+    assert(obj_vtable_publish(OBJ(&a), NULL) == 0);
+
+    atomic_store(&blocker.released, true);
+    assert(thrd_join(thread, NULL) == thrd_success);
+    assert(obj_signal_disconnect(&slow, OBJ(&blocker), "block") == 0);
+    obj_signal_destroy(&slow);
+
+    obj_signal_destroy(&signal);
+}
+
+void counter_add_twice_impl(obj_t* self, void* payload, const char* name)
+{
+    ((counter_t*)self)->value += 2 * *(int*)payload;
+}
+
+void test_obj_vtable_patch()
+{
+    counter_t counter;
+    counter_init(&counter);
+
+    int amount = 1;
+    OBJ_CALL(void, counter_add, OBJ(&counter), &amount);
+    assert(counter.value == 1);
+
+    obj_vtable_t* vtable = obj_vtable_clone(OBJ(&counter));
+    assert(vtable != NULL);
+    assert(OBJ_VTABLE_SET(vtable, counter_add, counter_add_twice_impl) == 0);
+    assert(obj_vtable_publish(OBJ(&counter), vtable) == 0);
+
+    // Existing objects use the new method, and so do new ones.
+    OBJ_CALL(void, counter_add, OBJ(&counter), &amount);
+    assert(counter.value == 3);
+
+    counter_t other;
+    counter_init(&other);
+    OBJ_CALL(void, counter_add, OBJ(&other), &amount);
+    assert(other.value == 2);
+
+    point_t point;
+    point_init(&point, 1, 2, "point");
+    vtable = obj_vtable_clone(OBJ(&counter));
+    assert(obj_vtable_publish(OBJ(&point), vtable) == EINVAL);
+    obj_vtable_discard(vtable);
+
+    assert(obj_vtable_publish(OBJ(&counter), NULL) == 0);
+    OBJ_CALL(void, counter_add, OBJ(&counter), &amount);
+    assert(counter.value == 4);
+}
+
+static atomic_bool patching;
+
+int patched_reader(void* arg)
+{
+    counter_t* counter = arg;
+    long calls = 0;
+    int amount = 1;
+    while (atomic_load(&patching))
+    {
+        OBJ_CALL(void, counter_add, OBJ(counter), &amount);
+        calls++;
+    }
+
+    // Every call went to one of the two methods.
+    assert(counter->value >= calls && counter->value <= 2 * calls);
+    return 0;
+}
+
+void test_obj_vtable_patch_concurrent()
+{
+    counter_t counters[4];
+    thrd_t threads[4];
+    atomic_store(&patching, true);
+    for (size_t i = 0; i < 4; i++)
+    {
+        counter_init(&counters[i]);
+        assert(thrd_create(&threads[i], patched_reader, &counters[i]) == thrd_success);
+    }
+
+    // Readers keep looking methods up while the tables they use are replaced and freed.
+    for (int i = 0; i < 1000; i++)
+    {
+        obj_vtable_t* vtable = obj_vtable_clone(OBJ(&counters[0]));
+        assert(OBJ_VTABLE_SET(vtable, counter_add, counter_add_twice_impl) == 0);
+        assert(obj_vtable_publish(OBJ(&counters[0]), vtable) == 0);
+        assert(obj_vtable_publish(OBJ(&counters[0]), NULL) == 0);
+    }
+
+    atomic_store(&patching, false);
+    for (size_t i = 0; i < 4; i++)
+    {
+        assert(thrd_join(threads[i], NULL) == thrd_success);
+    }
+}
+
+typedef struct
+{
+    void (*counter_add)(obj_t* self, void* payload, const char* name);
+} adder_t;
+
+typedef struct
+{
+    void (*counter_add)(obj_t* self, void* payload, const char* name);
+    void (*counter_sub)(obj_t* self, void* payload, const char* name);
+} accumulator_t;
+
+OBJ_INTERFACE(ADDER_IFACE, adder_t, OBJ_INTERFACE_METHOD(adder_t, counter_add));
+OBJ_INTERFACE(ACCUMULATOR_IFACE,
+              accumulator_t,
+              OBJ_INTERFACE_METHOD(accumulator_t, counter_add),
+              OBJ_INTERFACE_METHOD(accumulator_t, counter_sub));
+
+void test_obj_query_interface()
+{
+    counter_t counter;
+    counter_init(&counter);
+
+    const adder_t* adder = obj_query_interface(OBJ(&counter), &ADDER_IFACE);
+    assert(adder != NULL && adder->counter_add == counter_add_impl);
+    assert(obj_query_interface(OBJ(&counter), &ADDER_IFACE) == adder);
+
+    int amount = 3;
+    adder->counter_add(OBJ(&counter), &amount, NULL);
+    assert(counter.value == 3);
+
+    assert(obj_query_interface(OBJ(&counter), &ACCUMULATOR_IFACE) == NULL);
+    assert(obj_query_interface(OBJ(&counter), &ACCUMULATOR_IFACE) == NULL);
+
+    // Publishing replaces the cache, while the table already obtained stays usable.
+    obj_vtable_t* vtable = obj_vtable_clone(OBJ(&counter));
+    assert(OBJ_VTABLE_SET(vtable, counter_add, counter_add_twice_impl) == 0);
+    assert(obj_vtable_publish(OBJ(&counter), vtable) == 0);
+
+    const adder_t* patched = obj_query_interface(OBJ(&counter), &ADDER_IFACE);
+    assert(patched != NULL && patched != adder && patched->counter_add == counter_add_twice_impl);
+    assert(adder->counter_add == counter_add_impl);
+
+    assert(obj_vtable_publish(OBJ(&counter), NULL) == 0);
+    adder = obj_query_interface(OBJ(&counter), &ADDER_IFACE);
+    assert(adder->counter_add == counter_add_impl);
+}
+
+void test_obj_relocatable()
+{
+    point_t point;
+    point_init(&point, 1, 2, "point");
+    const uintptr_t type = obj_typeid(OBJ(&point));
+
+    assert(obj_make_relocatable(OBJ(&point)) == ENOENT);
+
+    size_t id;
+    size_t again;
+    assert(obj_type_register(OBJ(&point), &id) == 0);
+    assert(obj_type_register(OBJ(&point), &again) == 0 && again == id);
+
+    assert(obj_make_relocatable(OBJ(&point)) == 0);
+    assert((uintptr_t)point.__vptr != type);
+
+    // The header no longer depends on the address space, but the object behaves the same.
+    assert(obj_typeid(OBJ(&point)) == type);
+    assert(strcmp(obj_typeof(OBJ(&point)), "point_t") == 0);
+
+    char buffer[32];
+    obj_format(OBJ(&point), buffer, sizeof(buffer));
+    assert(strcmp(buffer, "point(1, 2)") == 0);
+
+    // A relocatable object still compares equal to a regular one of the same type.
+    point_t regular;
+    point_init(&regular, 1, 2, "point");
+    assert(obj_equals(OBJ(&point), OBJ(&regular)));
+    assert(obj_cmp(OBJ(&point), OBJ(&regular)) == 0);
+    assert(obj_hash(OBJ(&point)) == obj_hash(OBJ(&regular)));
+}
+
+typedef struct
+{
+    OBJ_HEADER
+    char kind;
+} resource_t;
+
+typedef struct
+{
+    OBJ_EXTENDS(resource_t)
+} special_resource_t;
+
+static char destroyed[16];
+static size_t destroyed_count;
+
+void obj_destroy_impl(obj_t* self)
+{
+    destroyed[destroyed_count++] = ((resource_t*)self)->kind;
+}
+
+void resource_destroy_loudly(obj_t* self)
+{
+    destroyed[destroyed_count++] = ((resource_t*)self)->kind - 'a' + 'A';
+}
+
+void resource_init(resource_t* self, char kind)
+{
+    OBJ_VTABLE_INIT(resource_t, OBJ_METHOD(obj_destroy));
+    self->kind = kind;
+}
+
+void special_resource_init(special_resource_t* self)
+{
+    resource_init(OBJ_BASE(self), 'b');
+    OBJ_VTABLE_INIT_DERIVED(special_resource_t);
+}
+
+void test_obj_arena()
+{
+    obj_arena_t arena;
+    obj_arena_create(&arena);
+
+    // Types are interleaved with objects that have no destructor and one never initialized.
+    for (int i = 0; i < 3; i++)
+    {
+        resource_init(obj_arena_alloc(&arena, sizeof(resource_t)), 'a');
+        special_resource_init(obj_arena_alloc(&arena, sizeof(special_resource_t)));
+        counter_init(obj_arena_alloc(&arena, sizeof(counter_t)));
+    }
+    obj_arena_alloc(&arena, sizeof(counter_t));
+
+    // A relocatable object is grouped with the regular ones of its type.
+    resource_t* relocatable = obj_arena_alloc(&arena, sizeof(resource_t));
+    resource_init(relocatable, 'a');
+    assert(obj_type_register(OBJ(relocatable), NULL) == 0);
+    assert(obj_make_relocatable(OBJ(relocatable)) == 0);
+
+    obj_arena_reset(&arena);
+    assert(destroyed_count == 7);
+    assert(strcmp(destroyed, "aaaabbb") == 0 || strcmp(destroyed, "bbbaaaa") == 0);
+
+    // A destructor published after the previous reset is used by the next one.
+    resource_t prototype;
+    resource_init(&prototype, 'a');
+
+    obj_vtable_t* vtable = obj_vtable_clone(OBJ(&prototype));
+    assert(OBJ_VTABLE_SET(vtable, obj_destroy, resource_destroy_loudly) == 0);
+    assert(obj_vtable_publish(OBJ(&prototype), vtable) == 0);
+
+    memset(destroyed, 0, sizeof(destroyed));
+    destroyed_count = 0;
+    resource_init(obj_arena_alloc(&arena, sizeof(resource_t)), 'a');
+    obj_arena_reset(&arena);
+    assert(strcmp(destroyed, "A") == 0);
+
+    assert(obj_vtable_publish(OBJ(&prototype), NULL) == 0);
+    obj_arena_destroy(&arena);
+}
+
+// The type ids of these names collide.
+typedef struct
+{
+    OBJ_HEADER
+    int sides;
+} shape598958_t;
+
+typedef struct
+{
+    OBJ_HEADER
+    int sides;
+} shape655206_t;
+
+void shape598958_init(shape598958_t* self, int sides)
+{
+    OBJ_VTABLE_INIT_FIELDS(shape598958_t, OBJ_FIELDS(OBJ_FIELD(shape598958_t, sides)));
+    self->sides = sides;
+}
+
+void shape655206_init(shape655206_t* self, int sides)
+{
+    OBJ_VTABLE_INIT_FIELDS(shape655206_t, OBJ_FIELDS(OBJ_FIELD(shape655206_t, sides)));
+    self->sides = sides;
+}
+
+void test_objser()
+{
+    point_t first;
+    point_t second;
+    counter_t counter;
+    point_init(&first, 1, 2.5, "first");
+    point_init(&second, 3, 4.5, NULL);
+    counter_init(&counter);
+
+    FILE* file = tmpfile();
+    assert(file != NULL);
+
+    objser_writer_t writer;
+    assert(objser_writer_create(&writer, fileno(file)) == 0);
+    assert(objser_write(&writer, OBJ(&first)) == 0);
+    assert(objser_write(&writer, OBJ(&counter)) == 0);
+    assert(objser_write(&writer, OBJ(&second)) == 0);
+    assert(objser_writer_destroy(&writer) == 0);
+
+    objser_reader_t reader;
+    assert(objser_reader_create(&reader, fileno(file)) == 0);
+    assert(objser_reader_register(&reader, OBJ(&first)) == 0);
+    assert(objser_reader_register(&reader, OBJ(&second)) == EEXIST);
+
+    obj_t* object;
+    assert(objser_read(&reader, &object) == 0);
+    assert(obj_equals(object, OBJ(&first)));
+    assert(((point_t*)object)->name != first.name);
+
+    // counter_t is not registered, so its record is skipped.
+    assert(objser_read(&reader, &object) == ENOENT);
+
+    assert(objser_read(&reader, &object) == 0);
+    assert(obj_equals(object, OBJ(&second)));
+    assert(((point_t*)object)->name == NULL);
+
+    assert(objser_read(&reader, &object) == ENODATA);
+
+    objser_reader_destroy(&reader);
+    fclose(file);
+
+    // Types with colliding ids are told apart by their schema.
+    shape598958_t triangle;
+    shape655206_t square;
+    shape598958_init(&triangle, 3);
+    shape655206_init(&square, 4);
+
+    file = tmpfile();
+    assert(file != NULL);
+    assert(objser_writer_create(&writer, fileno(file)) == 0);
+    assert(objser_write(&writer, OBJ(&triangle)) == 0);
+    assert(objser_write(&writer, OBJ(&square)) == 0);
+    assert(objser_writer_destroy(&writer) == 0);
+
+    assert(objser_reader_create(&reader, fileno(file)) == 0);
+    assert(objser_reader_register(&reader, OBJ(&square)) == 0);
+    assert(objser_reader_register(&reader, OBJ(&triangle)) == 0);
+    assert(objser_read(&reader, &object) == 0 && obj_equals(object, OBJ(&triangle)));
+    assert(objser_read(&reader, &object) == 0 && obj_equals(object, OBJ(&square)));
+
+    objser_reader_destroy(&reader);
+    fclose(file);
+}
+
+void actor_throughput()
+{
+    const int count = 4000000;
+    const int one = 1;
+
+    actor_pool_t pool;
+    actor_pool_create(&pool, 4, 0);
+
+    counter_t counters[4];
+    actor_t actors[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        counter_init(&counters[i]);
+        actor_create(&actors[i], &pool, OBJ(&counters[i]));
+    }
+
+    struct timespec start;
+    struct timespec end;
+    timespec_get(&start, TIME_UTC);
+
+    for (int i = 0; i < count; i++)
+    {
+        ACTOR_SEND(&actors[i % 4], counter_add, &one);
+    }
+    actor_pool_wait(&pool);
+
+    timespec_get(&end, TIME_UTC);
+    double time = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        actor_destroy(&actors[i]);
+    }
+    actor_pool_destroy(&pool);
+
+    fprintf(stderr, "actor_throughput (%i messages):\n%lf msg/s\n", count, count / time);
+}
+
+void with_try()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        try
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+void with_try_fast()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        try_fast
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+void with_try_with_deadline()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        try_with_deadline (1000)
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+void throw_with_try()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        try_fast
+        {
+            parse_digit_or_throw('x');
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+void throw_with_catch_clauses()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        try_fast
+        {
+            parse_digit_or_throw('x');
+        }
+        catch (arithmetic_error_t, e)
+        {
+        }
+        catch (memory_error_t, e)
+        {
+        }
+        catch_one_of (e, int, double, stack_corruption_error_t)
+        {
+        }
+        catch_any
+        {
+        }
+    }
+}
+
+void throw_with_try_result()
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        EXCEPT_RESULT(int) result = try_result(int, parse_digit_or_throw('x'));
+        except_discard(&result.error);
+    }
 }
 
 void with_defer()
@@ -171,8 +1729,41 @@ int main()
 
     test_throw();
     test_no_throw();
+    test_throw_type();
+    test_throw_derived();
+    test_catch_one_of();
+    test_throw_chained();
+    test_throw_backtrace();
+    test_except_stats();
+    test_except_future();
+    test_except_log();
+    test_try_result();
+    test_throw_defer();
     test_signal();
+    test_signal_fast();
+    test_signal_stack_overflow();
+    test_try_with_deadline();
+    test_except_malloc();
+
+    test_obj_fields();
+    test_obj_format();
+    test_obj_derived();
+    test_actor();
+    test_obj_signal();
+    test_obj_vtable_patch();
+    test_obj_vtable_patch_concurrent();
+    test_obj_query_interface();
+    test_obj_relocatable();
+    test_obj_arena();
+    test_objser();
 
     benchmark(with_defer, "with_defer");
     benchmark(without_defer, "without_defer");
+    benchmark(with_try, "with_try");
+    benchmark(with_try_fast, "with_try_fast");
+    benchmark(with_try_with_deadline, "with_try_with_deadline");
+    benchmark(throw_with_try, "throw_with_try");
+    benchmark(throw_with_catch_clauses, "throw_with_catch_clauses");
+    benchmark(throw_with_try_result, "throw_with_try_result");
+    actor_throughput();
 }
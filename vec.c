@@ -27,6 +27,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef VEC_WITH_EXCEPT
+#include "except.h"
+#define _VEC_MALLOC  except_malloc
+#define _VEC_REALLOC except_realloc
+#else
+#define _VEC_MALLOC  malloc
+#define _VEC_REALLOC realloc
+#endif
+
 static void x_memswap(void* restrict a, void* restrict b, size_t size)
 {
     if (a == b)
@@ -42,7 +51,7 @@ static void x_memswap(void* restrict a, void* restrict b, size_t size)
 
 int _vec_create(void** self, size_t elem_size, size_t capacity)
 {
-    struct _vec_header* vec = malloc(sizeof(struct _vec_header) + VEC_DEFAULT_CAP * elem_size);
+    struct _vec_header* vec = _VEC_MALLOC(sizeof(struct _vec_header) + VEC_DEFAULT_CAP * elem_size);
 
     if (vec == NULL)
     {
@@ -95,7 +104,7 @@ int vec_reserve(void* self, size_t elem_count)
     }
 
     struct _vec_header* new_vec =
-        realloc(vec, sizeof(struct _vec_header) + new_cap * vec->elem_size);
+        _VEC_REALLOC(vec, sizeof(struct _vec_header) + new_cap * vec->elem_size);
     if (new_vec == NULL)
     {
         return ENOMEM;
@@ -113,7 +122,7 @@ int vec_pack(void* self)
     size_t new_cap = vec->size == 0 ? 1 : vec->size;
 
     struct _vec_header* new_vec =
-        realloc(vec, sizeof(struct _vec_header) + new_cap * vec->elem_size);
+        _VEC_REALLOC(vec, sizeof(struct _vec_header) + new_cap * vec->elem_size);
     if (new_vec == NULL)
     {
         return ENOMEM;
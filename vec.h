@@ -68,6 +68,10 @@
  *
  * A vector is not pinned in memory and may reallocate occasionally. As such it is not advised to
  * keep pointers to a vector's elements.
+ *
+ * When libvec is built with VEC_WITH_EXCEPT, allocation failures throw libexcept's
+ * out_of_memory_error_t instead of returning ENOMEM, leaving the vector unchanged. Functions
+ * documented to return ENOMEM then always return 0.
  */
 
 #include <errno.h>